@@ -1,25 +1,54 @@
 #include <am.h>
 #include <nemu.h>
 
-#define SYNC_ADDR (VGACTL_ADDR + 4)
+#define SYNC_ADDR   (VGACTL_ADDR + 4)
+#define VMEMSZ_ADDR (VGACTL_ADDR + 8)
+#define CMD_ADDR    (VGACTL_ADDR + 12)
+#define ARG_ADDR(i) (VGACTL_ADDR + 16 + (i) * 4)
+
+// commands of the 2D acceleration in the VGA controller of NEMU
+enum { GPU_CMD_NONE, GPU_CMD_BLIT, GPU_CMD_MEMCPY, GPU_CMD_RENDER };
+
+static int vmemsz = 0;
 
 void __am_gpu_init() {
+  vmemsz = inl(VMEMSZ_ADDR);
 }
 
 void __am_gpu_config(AM_GPU_CONFIG_T *cfg) {
   *cfg = (AM_GPU_CONFIG_T) {
-    .present = true, .has_accel = false,
+    .present = true, .has_accel = (vmemsz != 0),
     .width = 0, .height = 0,
-    .vmemsz = 0
+    .vmemsz = vmemsz
   };
 }
 
 void __am_gpu_fbdraw(AM_GPU_FBDRAW_T *ctl) {
+  if (vmemsz != 0 && ctl->w != 0 && ctl->h != 0) {
+    outl(ARG_ADDR(0), ctl->x);
+    outl(ARG_ADDR(1), ctl->y);
+    outl(ARG_ADDR(2), (uintptr_t)ctl->pixels);
+    outl(ARG_ADDR(3), ctl->w);
+    outl(ARG_ADDR(4), ctl->h);
+    outl(CMD_ADDR, GPU_CMD_BLIT);
+  }
   if (ctl->sync) {
     outl(SYNC_ADDR, 1);
   }
 }
 
+void __am_gpu_memcpy(AM_GPU_MEMCPY_T *params) {
+  outl(ARG_ADDR(0), params->dest);
+  outl(ARG_ADDR(1), (uintptr_t)params->src);
+  outl(ARG_ADDR(2), params->size);
+  outl(CMD_ADDR, GPU_CMD_MEMCPY);
+}
+
+void __am_gpu_render(AM_GPU_RENDER_T *ren) {
+  outl(ARG_ADDR(0), ren->root);
+  outl(CMD_ADDR, GPU_CMD_RENDER);
+}
+
 void __am_gpu_status(AM_GPU_STATUS_T *status) {
   status->ready = true;
 }
@@ -4,5 +4,6 @@
 #include <common.h>
 
 void cpu_exec(uint64_t n);
+void cpu_exec_silent(uint64_t n);
 
 #endif
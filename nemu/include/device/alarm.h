@@ -5,5 +5,6 @@
 
 typedef void (*alarm_handler_t) ();
 void add_alarm_handle(alarm_handler_t h);
+uint64_t device_time();
 
 #endif
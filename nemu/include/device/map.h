@@ -5,6 +5,7 @@
 
 typedef void(*io_callback_t)(uint32_t, int, bool);
 uint8_t* new_space(int size);
+uint8_t* io_space_used(int *size);
 
 typedef struct {
   const char *name;
@@ -18,4 +18,42 @@ enum { DIFFTEST_TO_DUT, DIFFTEST_TO_REF };
 # error Unsupport ISA
 #endif
 
+// the granularity of memory comparison with `difftest_memhash()`
+#define DIFFTEST_PAGE_SIZE 4096
+
+/* The hash function shared by DUT and REF to compare memory pages.
+ * It follows the accumulation loop of XXH3: the 4 lanes are independent,
+ * so that the compiler can vectorize the loop with SIMD instructions.
+ * `len` should be a multiple of 32.
+ */
+static inline uint64_t difftest_page_hash(const void *buf, int len) {
+  static const uint64_t key[4] = {
+    0xbe4ba423396cfeb8ull, 0x1cad21f72c81017cull,
+    0xdb979083e96dd4deull, 0x1f67b3b7a4a44072ull,
+  };
+  uint64_t acc[4] = {
+    0x9e3779b185ebca87ull, 0xc2b2ae3d27d4eb4full,
+    0x165667b19e3779f9ull, 0x85ebca77c2b2ae63ull,
+  };
+  const uint64_t *p = (const uint64_t *)buf;
+  int i, j;
+  for (i = 0; i < len / 8; i += 4) {
+    for (j = 0; j < 4; j ++) {
+      uint64_t data = p[i + j];
+      uint64_t data_key = data ^ key[j];
+      acc[j ^ 1] += data;
+      acc[j] += (data_key & 0xffffffffu) * (data_key >> 32);
+    }
+  }
+  uint64_t h = len * 0x9e3779b185ebca87ull;
+  for (j = 0; j < 4; j ++) {
+    h ^= acc[j] * 0xc2b2ae3d27d4eb4full;
+    h = ((h << 31) | (h >> 33)) * 0x9e3779b185ebca87ull;
+  }
+  h ^= h >> 37;
+  h *= 0x165667919e3779f9ull;
+  h ^= h >> 32;
+  return h;
+}
+
 #endif
@@ -17,6 +17,7 @@ void init_isa();
 extern CPU_state cpu;
 void isa_reg_display();
 word_t isa_reg_str2val(const char *name, bool *success);
+word_t* isa_reg_str2ptr(const char *name);
 
 // exec
 struct Decode;
@@ -0,0 +1,83 @@
+#ifndef __ITRACE_DEF_H__
+#define __ITRACE_DEF_H__
+
+#include <stdint.h>
+#include <string.h>
+
+/* The binary instruction trace, shared by NEMU and tools/itrace-dis.
+ *
+ * The ring buffer is divided into blocks, and each block can be decoded
+ * by itself, so that the oldest blocks can be overwritten. A dump is
+ *   ITraceHeader | { ITraceBlock | entries } * nr_block
+ * from the oldest block to the newest one. Each entry starts with a byte
+ *   bit 0     the PC is not next to the last instruction, and the
+ *             difference follows as a zigzag LEB128 integer
+ *   bit 1     the instruction is the same as the last one at this PC
+ *             in the cache, otherwise its bytes follow
+ *   bit 2-5   the length of the instruction
+ */
+
+#define ITRACE_MAGIC 0x43525449 // "ITRC"
+#define ITRACE_VERSION 1
+#define ITRACE_BLOCK_SIZE 4096
+#define ITRACE_MAX_ILEN 15
+// the longest entry: the header, a 64-bit LEB128 integer and the instruction
+#define ITRACE_MAX_ENTRY (1 + 10 + ITRACE_MAX_ILEN)
+#define ITRACE_CACHE_BITS 8
+
+enum { ITRACE_PC_DELTA = 1, ITRACE_CACHED = 2 };
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  char isa[16];
+  uint32_t nr_block;
+} ITraceHeader;
+
+typedef struct {
+  uint64_t first; // the index of the first instruction in the block
+  uint32_t size;  // the size of the entries
+} ITraceBlock;
+
+typedef struct {
+  uint64_t pc;
+  uint8_t ilen;
+  uint8_t instr[ITRACE_MAX_ILEN];
+} ITraceCache;
+
+static inline uint32_t itrace_cache_idx(uint64_t pc) {
+  return ((uint32_t)pc * 2654435761u) >> (32 - ITRACE_CACHE_BITS);
+}
+
+/* Decode the entry at `p` into `*pc`, `instr` and `*ilen`, with `*next_pc`
+ * and `cache` being the state of the decoder. They should be cleared at the
+ * beginning of each block. Return the position of the next entry. */
+static inline const uint8_t* itrace_decode(const uint8_t *p, uint64_t *next_pc,
+    ITraceCache *cache, uint64_t *pc, uint8_t *instr, int *ilen) {
+  uint8_t h = *p ++;
+  *pc = *next_pc;
+  if (h & ITRACE_PC_DELTA) {
+    uint64_t v = 0;
+    int shift = 0;
+    do {
+      v |= (uint64_t)(*p & 0x7f) << shift;
+      shift += 7;
+    } while (*p ++ & 0x80);
+    *pc += (v >> 1) ^ -(v & 1);
+  }
+  *ilen = (h >> 2) & 0xf;
+  ITraceCache *c = &cache[itrace_cache_idx(*pc)];
+  if (h & ITRACE_CACHED) {
+    memcpy(instr, c->instr, *ilen);
+  } else {
+    memcpy(instr, p, *ilen);
+    p += *ilen;
+    c->pc = *pc;
+    c->ilen = *ilen;
+    memcpy(c->instr, instr, *ilen);
+  }
+  *next_pc = *pc + *ilen;
+  return p;
+}
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef __LOG_DEF_H__
+#define __LOG_DEF_H__
+
+#include <stdint.h>
+
+/* The compressed log, shared by NEMU and tools/log-unpack. The file is
+ * a sequence of frames, each of which is a LogFrame followed by `size`
+ * bytes: the data of `raw_size` bytes compressed by lz_compress(), or the
+ * data itself if `size == raw_size`.
+ */
+
+#define LOG_FRAME_MAX 65536
+
+typedef struct {
+  uint32_t raw_size;
+  uint32_t size;
+} LogFrame;
+
+#endif
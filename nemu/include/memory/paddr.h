@@ -15,6 +15,23 @@ static inline bool in_pmem(paddr_t addr) {
 }
 
 word_t paddr_read(paddr_t addr, int len);
+// the same as paddr_read(), but traced as an instruction fetch
+word_t paddr_ifetch(paddr_t addr, int len);
+// the same as paddr_read(), but not traced, for the reads by the debugger
+word_t paddr_peek(paddr_t addr, int len);
 void paddr_write(paddr_t addr, int len, word_t data);
 
+/* Memory watchpoints. The pages of the watched range are marked, and the
+ * stores to them are recorded. paddr_watch_hit() returns whether there
+ * is such a store since the last call. */
+void paddr_watch(paddr_t addr, int len, bool enable);
+bool paddr_watch_hit();
+
+/* Dirty pages. A page is dirty if it differs from its initial values,
+ * which are zeros or random values (see CONFIG_MEM_RANDOM), so only the
+ * dirty pages need to be saved. paddr_reset() restores the initial
+ * values of the whole pmem. */
+void paddr_reset();
+bool paddr_is_dirty(paddr_t addr);
+
 #endif
@@ -0,0 +1,32 @@
+#ifndef __MTRACE_DEF_H__
+#define __MTRACE_DEF_H__
+
+#include <stdint.h>
+
+/* The binary memory trace, shared by NEMU and tools/mtrace-hist.
+ * The file is an MTraceHeader followed by the records in the order
+ * of the accesses.
+ */
+
+#define MTRACE_MAGIC 0x4352544d // "MTRC"
+#define MTRACE_VERSION 1
+
+enum { MTRACE_READ = 1, MTRACE_WRITE = 2, MTRACE_FETCH = 4 };
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  char isa[16];
+} MTraceHeader;
+
+typedef struct {
+  uint64_t pc;
+  uint64_t addr;
+  uint64_t data;
+  uint8_t len;
+  uint8_t type;
+  // explicit, so that it is zeroed with the other members
+  uint8_t reserved[6];
+} MTraceEntry;
+
+#endif
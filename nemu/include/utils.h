@@ -19,8 +19,83 @@ extern NEMUState nemu_state;
 
 uint64_t get_time();
 
+// ----------- perf -----------
+
+/* The host time spent in each part of the execution with --perf-stats,
+ * in cycles of the time-stamp counter on x86 hosts, or in ns otherwise. */
+enum { PERF_TOTAL, PERF_DECODE, PERF_EXEC, PERF_MEM, PERF_DEVICE, NR_PERF };
+extern bool g_perf_stats;
+// set only while the guest instruction is executed with --perf-stats, so
+// that the memory accesses by the debugger are not counted in PERF_MEM
+extern bool g_perf_mem;
+extern uint64_t g_perf_cycles[NR_PERF];
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PERF_UNIT "cycles"
+static inline uint64_t perf_cycles() { return __builtin_ia32_rdtsc(); }
+#else
+#include <time.h>
+#define PERF_UNIT "ns"
+static inline uint64_t perf_cycles() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000000000ull + t.tv_nsec;
+}
+#endif
+
+// ----------- event trace -----------
+
+void event_begin(const char *name);
+void event_end(const char *name);
+#define EVENT_BEGIN(name) IFDEF(CONFIG_EVENT_TRACE, event_begin(name))
+#define EVENT_END(name) IFDEF(CONFIG_EVENT_TRACE, event_end(name))
+
+// ----------- compress -----------
+
+// the hash table of lz_compress(), which can not be shared by threads
+#define LZ_HTAB_SIZE (1 << 13)
+int lz_compress(const void *in, int in_len, void *out, int out_len, uint32_t *htab);
+int lz_decompress(const void *in, int in_len, void *out, int out_len);
+
+// ----------- symbol -----------
+
+typedef struct {
+  vaddr_t start, end;
+  const char *name;
+} Symbol;
+
+void init_symbol(const char *elf_file);
+// return the index of the function containing `addr`, or -1 if none
+int symbol_find(vaddr_t addr);
+// return the index of the function named `name`, or -1 if none
+int symbol_lookup(const char *name);
+const Symbol* symbol_get(int idx);
+int symbol_nr();
+// write "FUNC+0xOFFSET" for `addr` to `buf`, or "" if it is in no function
+void symbol_where(vaddr_t addr, char *buf, int len);
+
+// ----------- pc count -----------
+
+typedef struct {
+  vaddr_t pc;
+  uint64_t cnt;  // 0 if the slot is empty
+} PCCount;
+
+// the counts by PC in a hash table, which can be zero-initialized
+typedef struct {
+  PCCount *tab;
+  int bits, nr;
+} PCCounter;
+
+void pc_count(PCCounter *c, vaddr_t pc);
+// return the `c->nr` counts from the largest, which should be freed
+PCCount* pc_count_sorted(const PCCounter *c);
+
 // ----------- log -----------
 
+// with the thousands separators after setlocale(LC_NUMERIC, "")
+#define NUMBERIC_FMT MUXDEF(CONFIG_TARGET_AM, "%ld", "%'ld")
+
 #define ASNI_FG_BLACK   "\33[1;30m"
 #define ASNI_FG_RED     "\33[1;31m"
 #define ASNI_FG_GREEN   "\33[1;32m"
@@ -41,13 +116,24 @@ uint64_t get_time();
 
 #define ASNI_FMT(str, fmt) fmt str ASNI_NONE
 
-#define log_write(...) IFDEF(CONFIG_TARGET_NATIVE_ELF, \
+#ifdef CONFIG_LOG_ASYNC
+void log_printf(const char *fmt, ...);
+void log_flush();
+#define log_output(...) log_printf(__VA_ARGS__)
+#else
+#define log_output(...) \
   do { \
     extern FILE* log_fp; \
+    fprintf(log_fp, __VA_ARGS__); \
+    fflush(log_fp); \
+  } while (0)
+#endif
+
+#define log_write(...) IFDEF(CONFIG_TARGET_NATIVE_ELF, \
+  do { \
     extern bool log_enable(); \
     if (log_enable()) { \
-      fprintf(log_fp, __VA_ARGS__); \
-      fflush(log_fp); \
+      log_output(__VA_ARGS__); \
     } \
   } while (0) \
 )
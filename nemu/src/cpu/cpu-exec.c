@@ -15,24 +15,90 @@ CPU_state cpu = {};
 uint64_t g_nr_guest_instr = 0;
 static uint64_t g_timer = 0; // unit: us
 static bool g_print_step = false;
+static bool g_silent = false;
+bool g_perf_stats = false;
+bool g_perf_mem = false;
+uint64_t g_perf_cycles[NR_PERF] = {};
 const rtlreg_t rzero = 0;
 rtlreg_t tmp_reg[4];
 
 void device_update();
-void fetch_decode(Decode *s, vaddr_t pc);
+void key_statistic();
+int fetch_decode(Decode *s, vaddr_t pc);
 bool check_wp();
+bool check_bp(vaddr_t pc);
+bool auto_checkpoint();
+extern int g_nr_bp;
+extern uint64_t g_ckpt_instr;
+extern uint64_t g_trace_instr;
+extern bool g_trace_check;
+void trace_update(vaddr_t pc);
+void itrace_record(vaddr_t pc, const uint8_t *instr, int ilen);
+void itrace_dump(const char *file);
+void mtrace_flush();
+void ftrace_call(vaddr_t pc, vaddr_t target);
+void ftrace_ret(vaddr_t pc, vaddr_t target);
+void ftrace_jump(vaddr_t pc, vaddr_t target);
+void ftrace_report(const char *file);
+#ifdef CONFIG_PROFILE_BY_TIMER
+#include <signal.h>
+extern volatile sig_atomic_t g_profile_alarm;
+#else
+extern uint64_t g_profile_instr;
+#endif
+void profile_sample(vaddr_t pc);
+void profile_update();
+void profile_report();
+void exec_stat_block(vaddr_t pc, bool is_jump);
+void exec_stat_report(const uint64_t *exec_cnt, const char **exec_name, int n);
+bool log_enable();
+
+#ifdef CONFIG_ITRACE
+// format the trace of the instruction into `s->logbuf`
+static void itrace_format(Decode *s) {
+  char *p = s->logbuf;
+  p += snprintf(p, sizeof(s->logbuf), FMT_WORD ":", s->pc);
+  int ilen = s->snpc - s->pc;
+  int i;
+  uint8_t *instr = (uint8_t *)&s->isa.instr.val;
+  for (i = 0; i < ilen; i ++) {
+    p += snprintf(p, 4, " %02x", instr[i]);
+  }
+  int ilen_max = MUXDEF(CONFIG_ISA_x86, 8, 4);
+  int space_len = ilen_max - ilen;
+  if (space_len < 0) space_len = 0;
+  space_len = space_len * 3 + 1;
+  memset(p, ' ', space_len);
+  p += space_len;
+
+  void disassemble(char *str, int size, uint64_t pc, uint8_t *code, int nbyte);
+  disassemble(p, s->logbuf + sizeof(s->logbuf) - p,
+      MUXDEF(CONFIG_ISA_x86, s->snpc, s->pc), (uint8_t *)&s->isa.instr.val, ilen);
+}
+#endif
 
 static void trace_and_difftest(Decode *_this, vaddr_t dnpc) {
-#ifdef CONFIG_ITRACE_COND
-  if (ITRACE_COND) log_write("%s\n", _this->logbuf);
+#ifdef CONFIG_ITRACE
+  // the disassembly is costly, so skip it unless the trace is really output
+  bool is_log = ITRACE_COND && log_enable();
+  if (is_log || g_print_step) itrace_format(_this);
+  if (is_log) log_write("%s\n", _this->logbuf);
 #endif
   if (g_print_step) { IFDEF(CONFIG_ITRACE, puts(_this->logbuf)); }
-  IFDEF(CONFIG_DIFFTEST, difftest_step(_this->pc, dnpc));
+  IFDEF(CONFIG_ITRACE_RING, itrace_record(_this->pc,
+        (uint8_t *)&_this->isa.instr.val, _this->snpc - _this->pc));
+#ifdef CONFIG_DIFFTEST
+  EVENT_BEGIN("difftest_step");
+  difftest_step(_this->pc, dnpc);
+  EVENT_END("difftest_step");
+#endif
+#ifdef CONFIG_TARGET_NATIVE_ELF
   if (check_wp(_this->pc) == true) {
     if (nemu_state.state == NEMU_RUNNING) {
       nemu_state.state = NEMU_STOP;
     }
   }
+#endif
 }
 
 #include <isa-exec.h>
@@ -42,57 +108,113 @@ static const void* g_exec_table[TOTAL_INSTR] = {
   MAP(INSTR_LIST, FILL_EXEC_TABLE)
 };
 
+#define FILL_EXEC_NAME(name) [concat(EXEC_ID_, name)] = str(name),
+static const char* g_exec_name[TOTAL_INSTR] = {
+  MAP(INSTR_LIST, FILL_EXEC_NAME)
+};
+
+#ifdef CONFIG_EXEC_STAT
+// the instructions executed by EXEC_ID, reported by exec_stat_report()
+static uint64_t g_exec_cnt[TOTAL_INSTR] = {};
+#endif
+
+// the host time spent in executing each type of instructions, without memory
+static struct {
+  uint64_t cycles;
+  uint64_t cnt;
+} g_perf_exec[TOTAL_INSTR] = {};
+
+static void fetch_decode_exec_updatepc_perf(Decode *s) {
+  uint64_t start = perf_cycles();
+  int idx = fetch_decode(s, cpu.pc);
+  uint64_t decoded = perf_cycles();
+  uint64_t mem = g_perf_cycles[PERF_MEM];
+  g_perf_mem = true;
+  s->EHelper(s);
+  g_perf_mem = false;
+  cpu.pc = s->dnpc;
+  uint64_t end = perf_cycles();
+  g_perf_cycles[PERF_DECODE] += decoded - start;
+  g_perf_cycles[PERF_EXEC] += end - decoded;
+  g_perf_exec[idx].cycles += (end - decoded) - (g_perf_cycles[PERF_MEM] - mem);
+  g_perf_exec[idx].cnt ++;
+}
+
+static void perf_report() {
+  uint64_t n = 0;
+  int i, k;
+  for (i = 0; i < TOTAL_INSTR; i ++) n += g_perf_exec[i].cnt;
+  if (n == 0) return;
+  uint64_t *c = g_perf_cycles;
+  uint64_t other = c[PERF_TOTAL] - c[PERF_DECODE] - c[PERF_EXEC] - c[PERF_DEVICE];
+  Log("host " PERF_UNIT " per guest instruction = %.1f: decode %.1f, execute %.1f, "
+      "memory %.1f, device %.1f, others %.1f", (double)c[PERF_TOTAL] / n,
+      (double)c[PERF_DECODE] / n, (double)(c[PERF_EXEC] - c[PERF_MEM]) / n,
+      (double)c[PERF_MEM] / n, (double)c[PERF_DEVICE] / n, (double)other / n);
+
+  // show the instructions spending the most time in execution
+  uint64_t exec = c[PERF_EXEC] - c[PERF_MEM];
+  if (exec == 0) return;
+  bool shown[TOTAL_INSTR] = {};
+  for (k = 0; k < 10; k ++) {
+    int max = -1;
+    for (i = 0; i < TOTAL_INSTR; i ++) {
+      if (!shown[i] && g_perf_exec[i].cnt > 0 &&
+          (max < 0 || g_perf_exec[i].cycles > g_perf_exec[max].cycles)) max = i;
+    }
+    if (max < 0) break;
+    shown[max] = true;
+    Log("%7.2f%% of execution, %.1f " PERF_UNIT " x " NUMBERIC_FMT "  %s",
+        g_perf_exec[max].cycles * 100.0 / exec,
+        (double)g_perf_exec[max].cycles / g_perf_exec[max].cnt, g_perf_exec[max].cnt,
+        g_exec_name[max]);
+  }
+}
+
 static void fetch_decode_exec_updatepc(Decode *s) {
-  fetch_decode(s, cpu.pc);  // fetch and decode
-  s->EHelper(s);            // exec
-  cpu.pc = s->dnpc;         // update pc
+  if (unlikely(g_perf_stats)) fetch_decode_exec_updatepc_perf(s);
+  else {
+    fetch_decode(s, cpu.pc);  // fetch and decode
+    s->EHelper(s);            // exec
+    cpu.pc = s->dnpc;         // update pc
+  }
+  IFDEF(CONFIG_EXEC_STAT, exec_stat_block(s->pc, s->dnpc != s->snpc));
 }
 
 static void statistic() {
   IFNDEF(CONFIG_TARGET_AM, setlocale(LC_NUMERIC, ""));
-#define NUMBERIC_FMT MUXDEF(CONFIG_TARGET_AM, "%ld", "%'ld")
   Log("host time spent = " NUMBERIC_FMT " us", g_timer);
   Log("total guest instructions = " NUMBERIC_FMT, g_nr_guest_instr);
   if (g_timer > 0) Log("simulation frequency = " NUMBERIC_FMT " instr/s", g_nr_guest_instr * 1000000 / g_timer);
   else Log("Finish running in less than 1 us and can not calculate the simulation frequency");
+  IFDEF(CONFIG_HAS_KEYBOARD, key_statistic());
+  IFDEF(CONFIG_FTRACE, ftrace_report(CONFIG_FTRACE_PROFILE));
+  IFDEF(CONFIG_PROFILE, profile_report());
+  IFDEF(CONFIG_EXEC_STAT, exec_stat_report(g_exec_cnt, g_exec_name, TOTAL_INSTR));
+  if (g_perf_stats) perf_report();
 }
 
 void assert_fail_msg() {
   isa_reg_display();
+  IFDEF(CONFIG_ITRACE_RING, itrace_dump(CONFIG_ITRACE_RING_FILE));
+  IFDEF(CONFIG_MTRACE, mtrace_flush());
   statistic();
+  IFDEF(CONFIG_LOG_ASYNC, log_flush());
 }
 
-void fetch_decode(Decode *s, vaddr_t pc) {
+int fetch_decode(Decode *s, vaddr_t pc) {
   s->pc = pc;
   s->snpc = pc;
   int idx = isa_fetch_decode(s);
   s->dnpc = s->snpc;
   s->EHelper = g_exec_table[idx];
-#ifdef CONFIG_ITRACE
-  char *p = s->logbuf;
-  p += snprintf(p, sizeof(s->logbuf), FMT_WORD ":", s->pc);
-  int ilen = s->snpc - s->pc;
-  int i;
-  uint8_t *instr = (uint8_t *)&s->isa.instr.val;
-  for (i = 0; i < ilen; i ++) {
-    p += snprintf(p, 4, " %02x", instr[i]);
-  }
-  int ilen_max = MUXDEF(CONFIG_ISA_x86, 8, 4);
-  int space_len = ilen_max - ilen;
-  if (space_len < 0) space_len = 0;
-  space_len = space_len * 3 + 1;
-  memset(p, ' ', space_len);
-  p += space_len;
-
-  void disassemble(char *str, int size, uint64_t pc, uint8_t *code, int nbyte);
-  disassemble(p, s->logbuf + sizeof(s->logbuf) - p,
-      MUXDEF(CONFIG_ISA_x86, s->snpc, s->pc), (uint8_t *)&s->isa.instr.val, ilen);
-#endif
+  IFDEF(CONFIG_EXEC_STAT, g_exec_cnt[idx] ++);
+  return idx;
 }
 
 /* Simulate how the CPU works. */
 void cpu_exec(uint64_t n) {
-  g_print_step = (n < MAX_INSTR_TO_PRINT);
+  g_print_step = (n < MAX_INSTR_TO_PRINT && !g_silent);
   switch (nemu_state.state) {
     case NEMU_END: case NEMU_ABORT:
       printf("Program execution has ended. To restart the program, exit NEMU and run again.\n");
@@ -100,30 +222,72 @@ void cpu_exec(uint64_t n) {
     default: nemu_state.state = NEMU_RUNNING;
   }
 
+  EVENT_BEGIN("cpu_exec");
   uint64_t timer_start = get_time();
+  uint64_t perf_start = (g_perf_stats ? perf_cycles() : 0);
 
   Decode s;
+  IFDEF(CONFIG_TARGET_NATIVE_ELF, bool is_first = true);
+  // the number of instructions may go back by loading a snapshot
+  // or restarting a checkpoint, so the triggers are checked again
+  IFDEF(CONFIG_TARGET_NATIVE_ELF, IFDEF(CONFIG_TRACE, trace_update(cpu.pc)));
+  IFDEF(CONFIG_PROFILE_BY_INSTR, profile_update());
   for (;n > 0; n --) {
+#ifdef CONFIG_TARGET_NATIVE_ELF
+    // stop before the instruction at a breakpoint, but do not
+    // stop again at the first instruction when resuming from it
+    if (unlikely(g_nr_bp > 0) && !is_first && check_bp(cpu.pc)) {
+      if (!g_silent) printf("Hit breakpoint at " FMT_WORD ".\n", cpu.pc);
+      nemu_state.state = NEMU_STOP;
+      break;
+    }
+    is_first = false;
+    if (unlikely(g_nr_guest_instr >= g_ckpt_instr) && auto_checkpoint()) {
+      nemu_state.state = NEMU_STOP;
+      break;
+    }
+    IFDEF(CONFIG_PROFILE, if (unlikely(MUXDEF(CONFIG_PROFILE_BY_TIMER, g_profile_alarm,
+        g_nr_guest_instr >= g_profile_instr))) profile_sample(cpu.pc));
+    IFDEF(CONFIG_TRACE, if (unlikely(g_trace_check || g_nr_guest_instr >= g_trace_instr)) trace_update(cpu.pc));
+#endif
     fetch_decode_exec_updatepc(&s);
     g_nr_guest_instr ++;
     trace_and_difftest(&s, cpu.pc);
     if (nemu_state.state != NEMU_RUNNING) break;
-    IFDEF(CONFIG_DEVICE, device_update());
+#ifdef CONFIG_DEVICE
+    if (unlikely(g_perf_stats)) {
+      uint64_t t = perf_cycles();
+      device_update();
+      g_perf_cycles[PERF_DEVICE] += perf_cycles() - t;
+    } else device_update();
+#endif
   }
+  if (g_perf_stats) g_perf_cycles[PERF_TOTAL] += perf_cycles() - perf_start;
 
   uint64_t timer_end = get_time();
   g_timer += timer_end - timer_start;
+  EVENT_END("cpu_exec");
 
   switch (nemu_state.state) {
     case NEMU_RUNNING: nemu_state.state = NEMU_STOP; break;
 
     case NEMU_END: case NEMU_ABORT:
-      Log("nemu: %s at pc = " FMT_WORD,
+      if (!g_silent) Log("nemu: %s at pc = " FMT_WORD,
           (nemu_state.state == NEMU_ABORT ? ASNI_FMT("ABORT", ASNI_FG_RED) :
            (nemu_state.halt_ret == 0 ? ASNI_FMT("HIT GOOD TRAP", ASNI_FG_GREEN) :
             ASNI_FMT("HIT BAD TRAP", ASNI_FG_RED))),
           nemu_state.halt_pc);
+#ifdef CONFIG_ITRACE_RING
+      if (nemu_state.state == NEMU_ABORT) itrace_dump(CONFIG_ITRACE_RING_FILE);
+#endif
       // fall through
     case NEMU_QUIT: statistic();
   }
 }
+
+// for the callers which report the stops in their own way, such as the gdb stub
+void cpu_exec_silent(uint64_t n) {
+  g_silent = true;
+  cpu_exec(n);
+  g_silent = false;
+}
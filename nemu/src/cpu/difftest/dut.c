@@ -3,6 +3,7 @@
 #include <isa.h>
 #include <cpu/cpu.h>
 #include <memory/paddr.h>
+#include <memory/host.h>
 #include <utils.h>
 #include <difftest-def.h>
 
@@ -10,12 +11,25 @@ void (*ref_difftest_memcpy)(paddr_t addr, void *buf, size_t n, bool direction) =
 void (*ref_difftest_regcpy)(void *dut, bool direction) = NULL;
 void (*ref_difftest_exec)(uint64_t n) = NULL;
 void (*ref_difftest_raise_intr)(uint64_t NO) = NULL;
+void (*ref_difftest_memhash)(paddr_t *addr, uint64_t *hash, int n) = NULL;
 
 #ifdef CONFIG_DIFFTEST
 
 static bool is_skip_ref = false;
 static int skip_dut_nr_instr = 0;
 
+#if CONFIG_DIFFTEST_BATCH > 1
+static void difftest_sync();
+static void set_checkpoint(CPU_state *s);
+#endif
+
+#ifdef CONFIG_DIFFTEST_RING
+void init_ring();
+void ring_step(vaddr_t pc);
+void ring_log_store(paddr_t addr, int len);
+void ring_dump();
+#endif
+
 // this is used to let ref skip instructions which
 // can not produce consistent behavior with NEMU
 void difftest_skip_ref() {
@@ -38,6 +52,9 @@ void difftest_skip_ref() {
 //   We expect that DUT will catch up with REF within `nr_dut` instructions.
 void difftest_skip_dut(int nr_ref, int nr_dut) {
   skip_dut_nr_instr += nr_dut;
+#if CONFIG_DIFFTEST_BATCH > 1
+  difftest_sync();
+#endif
 
   while (nr_ref -- > 0) {
     ref_difftest_exec(1);
@@ -63,6 +80,9 @@ void init_difftest(char *ref_so_file, long img_size, int port) {
   ref_difftest_raise_intr = dlsym(handle, "difftest_raise_intr");
   assert(ref_difftest_raise_intr);
 
+  // optional, only required by CONFIG_DIFFTEST_MEMHASH
+  ref_difftest_memhash = dlsym(handle, "difftest_memhash");
+
   void (*ref_difftest_init)(int) = dlsym(handle, "difftest_init");
   assert(ref_difftest_init);
 
@@ -72,26 +92,227 @@ void init_difftest(char *ref_so_file, long img_size, int port) {
       "If it is not necessary, you can turn it off in menuconfig.", ref_so_file);
 
   ref_difftest_init(port);
-  ref_difftest_memcpy(RESET_VECTOR, guest_to_host(RESET_VECTOR), img_size, DIFFTEST_TO_REF);
+#ifdef CONFIG_DIFFTEST_MEMHASH
+  // the whole pages are compared, and the bytes around the image may be
+  // random (see CONFIG_MEM_RANDOM), so REF should start with all of them
+  ref_difftest_memcpy(CONFIG_MBASE, guest_to_host(CONFIG_MBASE), CONFIG_MSIZE, DIFFTEST_TO_REF);
+#else
+  // also copy the memory below the image, which may be restored by
+  // `--replay` or `--snapshot`
+  ref_difftest_memcpy(CONFIG_MBASE, guest_to_host(CONFIG_MBASE),
+      RESET_VECTOR - CONFIG_MBASE + img_size, DIFFTEST_TO_REF);
+#endif
   ref_difftest_regcpy(&cpu, DIFFTEST_TO_REF);
+#ifdef CONFIG_DIFFTEST_MEMHASH
+  if (ref_difftest_memhash == NULL) {
+    Log("%s does not support difftest_memhash(), memory will not be compared", ref_so_file);
+  }
+#endif
+#if CONFIG_DIFFTEST_BATCH > 1
+  Log("Registers are compared every %d instructions", CONFIG_DIFFTEST_BATCH);
+  set_checkpoint(&cpu);
+#endif
+  IFDEF(CONFIG_DIFFTEST_RING, init_ring());
+}
+
+// copy the whole state of DUT to REF, e.g. after DUT is restored from a snapshot
+void difftest_attach() {
+  ref_difftest_memcpy(CONFIG_MBASE, guest_to_host(CONFIG_MBASE), CONFIG_MSIZE, DIFFTEST_TO_REF);
+  ref_difftest_regcpy(&cpu, DIFFTEST_TO_REF);
+#if CONFIG_DIFFTEST_BATCH > 1
+  set_checkpoint(&cpu);
+#endif
+  IFDEF(CONFIG_DIFFTEST_RING, init_ring());
+}
+
+static void difftest_abort(vaddr_t pc) {
+  nemu_state.state = NEMU_ABORT;
+  nemu_state.halt_pc = pc;
+  isa_reg_display();
+  IFDEF(CONFIG_DIFFTEST_RING, ring_dump());
 }
 
 static void checkregs(CPU_state *ref, vaddr_t pc) {
-  if (!isa_difftest_checkregs(ref, pc)) {
+  if (!isa_difftest_checkregs(ref, pc)) difftest_abort(pc);
+}
+
+#if CONFIG_DIFFTEST_BATCH > 1
+/* Batched difftest. The states of DUT after each instruction since the last
+ * checkpoint are recorded in `dut_trace`, and the old data overwritten by
+ * the stores of DUT are recorded in `store_log`. REF runs the pending
+ * instructions at once, and only the last state is compared. On mismatch,
+ * the stores are undone in REF, and REF is single-stepped from the
+ * checkpoint to find the first diverging instruction.
+ */
+typedef struct {
+  paddr_t addr;
+  int len;
+  word_t data;
+} StoreLog;
+
+static CPU_state ckpt = {};
+static CPU_state dut_trace[CONFIG_DIFFTEST_BATCH] = {};
+static int nr_pending = 0;
+static StoreLog *store_log = NULL;
+static int nr_store = 0, store_log_size = 0;
+
+static void log_old_data(paddr_t addr, int len) {
+  if (nr_store == store_log_size) {
+    store_log_size = (store_log_size == 0 ? CONFIG_DIFFTEST_BATCH : store_log_size * 2);
+    store_log = realloc(store_log, sizeof(store_log[0]) * store_log_size);
+    assert(store_log);
+  }
+  store_log[nr_store ++] = (StoreLog) { .addr = addr, .len = len,
+    .data = host_read(guest_to_host(addr), len) };
+}
+
+static void set_checkpoint(CPU_state *s) {
+  ckpt = *s;
+  nr_pending = 0;
+  nr_store = 0;
+}
+
+static void bisect() {
+  int i;
+  for (i = nr_store - 1; i >= 0; i --) {
+    ref_difftest_memcpy(store_log[i].addr, &store_log[i].data, store_log[i].len, DIFFTEST_TO_REF);
+  }
+  ref_difftest_regcpy(&ckpt, DIFFTEST_TO_REF);
+
+  CPU_state ref_r, dut_r = cpu;
+  for (i = 0; i < nr_pending; i ++) {
+    vaddr_t pc = (i == 0 ? ckpt.pc : dut_trace[i - 1].pc);
+    ref_difftest_exec(1);
+    ref_difftest_regcpy(&ref_r, DIFFTEST_TO_DUT);
+    cpu = dut_trace[i];
+    bool ok = isa_difftest_checkregs(&ref_r, pc);
+    if (!ok) {
+      Log("The first diverging instruction is at pc = " FMT_WORD
+          ", %d instructions after the checkpoint", pc, i);
+      checkregs(&ref_r, pc);
+      break;
+    }
+  }
+  cpu = dut_r;
+  if (i == nr_pending) {
+    Log("Can not reproduce the mismatch by single-stepping from the checkpoint");
     nemu_state.state = NEMU_ABORT;
-    nemu_state.halt_pc = pc;
-    isa_reg_display();
+    nemu_state.halt_pc = cpu.pc;
   }
 }
 
+// let REF catch up with the last recorded state of DUT and compare
+static void difftest_sync() {
+  if (nr_pending == 0) return;
+
+  CPU_state ref_r;
+  CPU_state *dut_r = &dut_trace[nr_pending - 1];
+  ref_difftest_exec(nr_pending);
+  ref_difftest_regcpy(&ref_r, DIFFTEST_TO_DUT);
+
+  CPU_state cur = cpu;
+  vaddr_t pc = (nr_pending == 1 ? ckpt.pc : dut_trace[nr_pending - 2].pc);
+  cpu = *dut_r;
+  bool ok = isa_difftest_checkregs(&ref_r, pc);
+  cpu = cur;
+  if (!ok) {
+    Log("Mismatch within the last %d instructions, bisecting...", nr_pending);
+    bisect();
+  }
+  set_checkpoint(dut_r);
+}
+#endif
+
+#ifdef CONFIG_DIFFTEST_MEMHASH
+#define NR_PAGE (CONFIG_MSIZE / DIFFTEST_PAGE_SIZE)
+
+static bool is_dirty[NR_PAGE] = {};
+static paddr_t dirty_page[NR_PAGE] = {};
+static uint64_t ref_hash[NR_PAGE] = {};
+static int nr_dirty = 0;
+
+static void mark_dirty(paddr_t addr) {
+  int idx = (addr - CONFIG_MBASE) / DIFFTEST_PAGE_SIZE;
+  if (!is_dirty[idx]) {
+    is_dirty[idx] = true;
+    dirty_page[nr_dirty ++] = CONFIG_MBASE + idx * DIFFTEST_PAGE_SIZE;
+  }
+}
+
+// `nr_instr` is the number of instructions executed since the last check
+static void checkmem(vaddr_t pc, int nr_instr) {
+  if (nr_dirty == 0 || ref_difftest_memhash == NULL || nemu_state.state == NEMU_ABORT) return;
+
+  ref_difftest_memhash(dirty_page, ref_hash, nr_dirty);
+  int i;
+  for (i = 0; i < nr_dirty; i ++) {
+    uint8_t *dut_p = guest_to_host(dirty_page[i]);
+    if (difftest_page_hash(dut_p, DIFFTEST_PAGE_SIZE) == ref_hash[i]) continue;
+
+    // only transfer the whole page on mismatch
+    uint8_t ref_p[DIFFTEST_PAGE_SIZE];
+    ref_difftest_memcpy(dirty_page[i], ref_p, DIFFTEST_PAGE_SIZE, DIFFTEST_TO_DUT);
+    int j;
+    for (j = 0; j < DIFFTEST_PAGE_SIZE && ref_p[j] == dut_p[j]; j ++);
+    if (j == DIFFTEST_PAGE_SIZE) continue;
+    Log("memory is different after executing instruction at pc = " FMT_WORD
+        ", paddr = " FMT_PADDR ", right = 0x%02x, wrong = 0x%02x",
+        pc, dirty_page[i] + j, ref_p[j], dut_p[j]);
+    if (nr_instr > 1) {
+      Log("The memory is compared every %d instructions, so the store may be made "
+          "by any of them up to pc = " FMT_WORD, nr_instr, pc);
+    }
+    difftest_abort(pc);
+    break;
+  }
+
+  for (i = 0; i < nr_dirty; i ++) {
+    is_dirty[(dirty_page[i] - CONFIG_MBASE) / DIFFTEST_PAGE_SIZE] = false;
+  }
+  nr_dirty = 0;
+}
+#endif
+
+#if CONFIG_DIFFTEST_BATCH > 1 || defined(CONFIG_DIFFTEST_MEMHASH) || defined(CONFIG_DIFFTEST_RING)
+void difftest_log_store(paddr_t addr, int len) {
+  IFDEF(CONFIG_DIFFTEST_RING, ring_log_store(addr, len));
+#if CONFIG_DIFFTEST_BATCH > 1
+  log_old_data(addr, len);
+#endif
+#ifdef CONFIG_DIFFTEST_MEMHASH
+  mark_dirty(addr);
+  mark_dirty(addr + len - 1);
+#endif
+}
+#endif
+
 void difftest_step(vaddr_t pc, vaddr_t npc) {
   CPU_state ref_r;
 
+  IFDEF(CONFIG_DIFFTEST_RING, ring_step(pc));
+
+#if CONFIG_DIFFTEST_BATCH > 1
+  if (skip_dut_nr_instr == 0 && !is_skip_ref) {
+    dut_trace[nr_pending ++] = cpu;
+    if (nr_pending == CONFIG_DIFFTEST_BATCH) {
+      difftest_sync();
+      IFDEF(CONFIG_DIFFTEST_MEMHASH, checkmem(pc, CONFIG_DIFFTEST_BATCH));
+    }
+    return;
+  }
+  // the current instruction should be handled specially,
+  // so check the pending instructions before it
+  difftest_sync();
+#endif
+
   if (skip_dut_nr_instr > 0) {
     ref_difftest_regcpy(&ref_r, DIFFTEST_TO_DUT);
     if (ref_r.pc == npc) {
       skip_dut_nr_instr = 0;
       checkregs(&ref_r, npc);
+#if CONFIG_DIFFTEST_BATCH > 1
+      set_checkpoint(&cpu);
+#endif
       return;
     }
     skip_dut_nr_instr --;
@@ -104,6 +325,9 @@ void difftest_step(vaddr_t pc, vaddr_t npc) {
     // to skip the checking of an instruction, just copy the reg state to reference design
     ref_difftest_regcpy(&cpu, DIFFTEST_TO_REF);
     is_skip_ref = false;
+#if CONFIG_DIFFTEST_BATCH > 1
+    set_checkpoint(&cpu);
+#endif
     return;
   }
 
@@ -111,6 +335,7 @@ void difftest_step(vaddr_t pc, vaddr_t npc) {
   ref_difftest_regcpy(&ref_r, DIFFTEST_TO_DUT);
 
   checkregs(&ref_r, pc);
+  IFDEF(CONFIG_DIFFTEST_MEMHASH, checkmem(pc, 1));
 }
 #else
 void init_difftest(char *ref_so_file, long img_size, int port) { }
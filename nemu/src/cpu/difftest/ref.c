@@ -0,0 +1,46 @@
+#include <isa.h>
+#include <cpu/cpu.h>
+#include <difftest-def.h>
+#include <memory/paddr.h>
+
+void init_log(const char *log_file);
+void init_mem();
+
+// The interface below is exported when NEMU is built as a shared
+// object (TARGET_SHARE) and used as the reference design by another
+// NEMU, which loads it with dlopen() in `init_difftest()`.
+
+void difftest_memcpy(paddr_t addr, void *buf, size_t n, bool direction) {
+  if (direction == DIFFTEST_TO_REF) memcpy(guest_to_host(addr), buf, n);
+  else memcpy(buf, guest_to_host(addr), n);
+}
+
+void difftest_regcpy(void *dut, bool direction) {
+  isa_difftest_regcpy(dut, direction);
+}
+
+void difftest_exec(uint64_t n) {
+  cpu_exec(n);
+}
+
+void difftest_raise_intr(word_t NO) {
+  isa_difftest_raise_intr(NO);
+}
+
+void difftest_memhash(paddr_t *addr, uint64_t *hash, int n) {
+  int i;
+  for (i = 0; i < n; i ++) {
+    hash[i] = difftest_page_hash(guest_to_host(addr[i]), DIFFTEST_PAGE_SIZE);
+  }
+}
+
+void difftest_init(int port) {
+  /* There is no monitor in REF, so open the log here. */
+  init_log(NULL);
+
+  /* Initialize memory. */
+  init_mem();
+
+  /* Perform ISA dependent initialization. */
+  init_isa();
+}
@@ -0,0 +1,242 @@
+#include <isa.h>
+#include <cpu/cpu.h>
+#include <memory/paddr.h>
+#include <memory/host.h>
+#include <difftest-def.h>
+
+#ifdef CONFIG_DIFFTEST_RING
+
+/* Divergence log. The effects of the last CONFIG_DIFFTEST_RING_SIZE
+ * instructions of DUT are kept in a ring buffer, and dumped with the
+ * current state of DUT when difftest fails. Since the old values of the
+ * registers and the memory are also recorded, the state before the
+ * oldest instruction can be restored by `load_replay()`. Then NEMU
+ * re-executes the recorded instructions and checks them against the log,
+ * with REF being compared as usual.
+ * Only the dirty pages of pmem (see paddr_is_dirty()) are dumped,
+ * each of them compressed by lz_compress() if it can be.
+ */
+
+#define RING_MAX_REG 4
+#define RING_MAX_MEM 4
+#define NR_REG_SLOT (DIFFTEST_REG_SIZE / sizeof(word_t))
+#define RING_MAGIC 0x474e4952 // "RING"
+#define RING_VERSION 2
+#define PAGE_SIZE 4096
+
+extern uint64_t g_nr_guest_instr;
+
+typedef struct {
+  vaddr_t pc;
+  uint32_t instr;
+  // the number of writes, only the first RING_MAX_* of them are recorded
+  uint8_t nr_reg, nr_mem;
+  struct {
+    uint32_t idx;
+    word_t before, after;
+  } reg[RING_MAX_REG];
+  struct {
+    paddr_t addr;
+    uint32_t len;
+    word_t before, after;
+  } mem[RING_MAX_MEM];
+} RingEntry;
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  char isa[16];
+  uint32_t reg_size;
+  uint32_t entry_size;
+  uint32_t nr_entry;
+  uint32_t nr_page;
+  uint64_t nr_instr;
+} RingHeader;
+
+typedef struct {
+  paddr_t addr;
+  uint32_t size; // the size of the data, PAGE_SIZE if it is not compressed
+} RingPage;
+
+static RingEntry ring[CONFIG_DIFFTEST_RING_SIZE] = {};
+static uint64_t nr_entry = 0;
+static word_t last_regs[NR_REG_SLOT] = {};
+
+// the recorded instructions to check against in replay mode
+static RingEntry *replay_log = NULL;
+static uint32_t nr_replay = 0, replay_idx = 0;
+
+static inline RingEntry *cur_entry() {
+  return &ring[nr_entry % CONFIG_DIFFTEST_RING_SIZE];
+}
+
+void ring_log_store(paddr_t addr, int len) {
+  RingEntry *e = cur_entry();
+  if (e->nr_mem < RING_MAX_MEM) {
+    e->mem[e->nr_mem].addr = addr;
+    e->mem[e->nr_mem].len = len;
+    e->mem[e->nr_mem].before = host_read(guest_to_host(addr), len);
+  }
+  if (e->nr_mem < UINT8_MAX) e->nr_mem ++;
+}
+
+static bool check_replay(RingEntry *e) {
+  RingEntry *r = &replay_log[replay_idx];
+  int i;
+  if (e->pc != r->pc || e->instr != r->instr ||
+      e->nr_reg != r->nr_reg || e->nr_mem != r->nr_mem) return false;
+  for (i = 0; i < e->nr_reg && i < RING_MAX_REG; i ++) {
+    if (e->reg[i].idx != r->reg[i].idx || e->reg[i].after != r->reg[i].after) return false;
+  }
+  for (i = 0; i < e->nr_mem && i < RING_MAX_MEM; i ++) {
+    if (e->mem[i].addr != r->mem[i].addr || e->mem[i].after != r->mem[i].after) return false;
+  }
+  return true;
+}
+
+void init_ring() {
+  memcpy(last_regs, &cpu, sizeof(last_regs));
+}
+
+// called after each instruction of DUT
+void ring_step(vaddr_t pc) {
+  RingEntry *e = cur_entry();
+  e->pc = pc;
+  e->instr = 0;
+  if (in_pmem(pc)) memcpy(&e->instr, guest_to_host(pc), sizeof(e->instr));
+
+  word_t *regs = (word_t *)&cpu;
+  int i;
+  e->nr_reg = 0;
+  // the last slot is pc, which is recorded above
+  for (i = 0; i < NR_REG_SLOT - 1; i ++) {
+    if (regs[i] == last_regs[i]) continue;
+    if (e->nr_reg < RING_MAX_REG) {
+      e->reg[e->nr_reg].idx = i;
+      e->reg[e->nr_reg].before = last_regs[i];
+      e->reg[e->nr_reg].after = regs[i];
+    }
+    e->nr_reg ++;
+  }
+  memcpy(last_regs, regs, sizeof(last_regs));
+
+  for (i = 0; i < e->nr_mem && i < RING_MAX_MEM; i ++) {
+    e->mem[i].after = host_read(guest_to_host(e->mem[i].addr), e->mem[i].len);
+  }
+
+  if (replay_idx < nr_replay) {
+    if (!check_replay(e)) {
+      Log("Replay diverges from the log at pc = " FMT_WORD ", %d instructions after the start",
+          pc, replay_idx);
+      nemu_state.state = NEMU_STOP;
+      nr_replay = 0;
+    } else if (++ replay_idx == nr_replay) {
+      Log("Replay reaches the end of the log at pc = " FMT_WORD, pc);
+      nemu_state.state = NEMU_STOP;
+    }
+  }
+
+  nr_entry ++;
+  cur_entry()->nr_mem = 0;
+}
+
+void ring_dump() {
+  FILE *fp = fopen(CONFIG_DIFFTEST_RING_FILE, "wb");
+  if (fp == NULL) {
+    Log("Can not open '%s' to dump the divergence log", CONFIG_DIFFTEST_RING_FILE);
+    return;
+  }
+
+  static uint32_t htab[LZ_HTAB_SIZE];
+  uint8_t *pmem = guest_to_host(CONFIG_MBASE);
+  uint32_t nr_page = 0;
+  long i;
+  for (i = 0; i < CONFIG_MSIZE; i += PAGE_SIZE) {
+    if (paddr_is_dirty(CONFIG_MBASE + i)) nr_page ++;
+  }
+
+  int n = (nr_entry < CONFIG_DIFFTEST_RING_SIZE ? nr_entry : CONFIG_DIFFTEST_RING_SIZE);
+  RingHeader h = { .magic = RING_MAGIC, .version = RING_VERSION, .isa = str(__GUEST_ISA__),
+    .reg_size = DIFFTEST_REG_SIZE, .entry_size = sizeof(RingEntry),
+    .nr_entry = n, .nr_page = nr_page, .nr_instr = g_nr_guest_instr };
+  fwrite(&h, sizeof(h), 1, fp);
+  fwrite(&cpu, DIFFTEST_REG_SIZE, 1, fp);
+  // from the oldest to the newest
+  for (i = nr_entry - n; i < nr_entry; i ++) {
+    fwrite(&ring[i % CONFIG_DIFFTEST_RING_SIZE], sizeof(RingEntry), 1, fp);
+  }
+  uint8_t buf[PAGE_SIZE];
+  for (i = 0; i < CONFIG_MSIZE; i += PAGE_SIZE) {
+    if (!paddr_is_dirty(CONFIG_MBASE + i)) continue;
+    int len = lz_compress(pmem + i, PAGE_SIZE, buf, PAGE_SIZE - 1, htab);
+    RingPage pg = { .addr = CONFIG_MBASE + i, .size = (len == 0 ? PAGE_SIZE : len) };
+    fwrite(&pg, sizeof(pg), 1, fp);
+    fwrite(len == 0 ? pmem + i : buf, pg.size, 1, fp);
+  }
+  fclose(fp);
+
+  Log("The last %d instructions are dumped to %s, run NEMU with `--replay=%s` to replay them",
+      n, CONFIG_DIFFTEST_RING_FILE, CONFIG_DIFFTEST_RING_FILE);
+}
+
+// restore the state before the oldest instruction in the log,
+// return the size of memory from RESET_VECTOR to copy to REF
+long load_replay(const char *file) {
+  FILE *fp = fopen(file, "rb");
+  Assert(fp, "Can not open '%s'", file);
+
+  RingHeader h;
+  int ret = fread(&h, sizeof(h), 1, fp);
+  Assert(ret == 1 && h.magic == RING_MAGIC && h.version == RING_VERSION,
+      "'%s' is not a divergence log", file);
+  Assert(strcmp(h.isa, str(__GUEST_ISA__)) == 0 && h.reg_size == DIFFTEST_REG_SIZE &&
+      h.entry_size == sizeof(RingEntry), "'%s' is dumped by a different build of NEMU", file);
+
+  ret = fread(&cpu, DIFFTEST_REG_SIZE, 1, fp);
+  assert(ret == 1);
+  replay_log = malloc(sizeof(RingEntry) * h.nr_entry);
+  assert(replay_log);
+  ret = fread(replay_log, sizeof(RingEntry), h.nr_entry, fp);
+  assert(ret == h.nr_entry);
+
+  paddr_reset();
+  uint8_t buf[PAGE_SIZE];
+  uint32_t i;
+  for (i = 0; i < h.nr_page; i ++) {
+    RingPage pg;
+    ret = fread(&pg, sizeof(pg), 1, fp);
+    Assert(ret == 1 && in_pmem(pg.addr) && pg.size <= PAGE_SIZE, "'%s' is corrupted", file);
+    ret = fread(buf, pg.size, 1, fp);
+    Assert(ret == 1, "'%s' is corrupted", file);
+    if (pg.size == PAGE_SIZE) memcpy(guest_to_host(pg.addr), buf, PAGE_SIZE);
+    else {
+      ret = lz_decompress(buf, pg.size, guest_to_host(pg.addr), PAGE_SIZE);
+      Assert(ret == PAGE_SIZE, "'%s' is corrupted", file);
+    }
+  }
+  fclose(fp);
+
+  // undo the instructions from the newest to the oldest,
+  // until an instruction with too many writes to be undone
+  word_t *regs = (word_t *)&cpu;
+  for (i = h.nr_entry; i > 0; i --) {
+    RingEntry *e = &replay_log[i - 1];
+    if (e->nr_reg > RING_MAX_REG || e->nr_mem > RING_MAX_MEM) break;
+    int j;
+    for (j = e->nr_mem - 1; j >= 0; j --) {
+      host_write(guest_to_host(e->mem[j].addr), e->mem[j].len, e->mem[j].before);
+    }
+    for (j = e->nr_reg - 1; j >= 0; j --) {
+      regs[e->reg[j].idx] = e->reg[j].before;
+    }
+    cpu.pc = e->pc;
+  }
+  replay_log += i;
+  nr_replay = h.nr_entry - i;
+  replay_idx = 0;
+  g_nr_guest_instr = h.nr_instr - nr_replay;
+
+  Log("Replay %d instructions from pc = " FMT_WORD " in %s", nr_replay, cpu.pc, file);
+  return CONFIG_MSIZE - CONFIG_PC_RESET_OFFSET;
+}
+#endif
@@ -15,27 +15,52 @@ void init_disk();
 void init_sdcard();
 void init_alarm();
 
+void timer_intr();
 void send_key(uint8_t, bool);
+void key_script_update();
 void vga_update_screen();
 
+// the clock of the devices in us
+uint64_t device_time() {
+#ifdef CONFIG_DEVICE_DETERMINISTIC
+  extern uint64_t g_nr_guest_instr;
+  return g_nr_guest_instr / CONFIG_DEVICE_INSTR_PER_US;
+#else
+  return get_time();
+#endif
+}
+
 void device_update() {
   static uint64_t last = 0;
-  uint64_t now = get_time();
+  uint64_t now = device_time();
   if (now - last < 1000000 / TIMER_HZ) {
     return;
   }
   last = now;
+  EVENT_BEGIN("device_update");
 
-  IFDEF(CONFIG_HAS_VGA, vga_update_screen());
+#if defined(CONFIG_DEVICE_DETERMINISTIC) && defined(CONFIG_HAS_TIMER) && !defined(CONFIG_TARGET_AM)
+  // the alarm goes by the host time, so raise the timer interrupt
+  // here by the device clock instead
+  timer_intr();
+#endif
+
+#ifdef CONFIG_HAS_VGA
+  EVENT_BEGIN("vga_update_screen");
+  vga_update_screen();
+  EVENT_END("vga_update_screen");
+#endif
 
 #ifndef CONFIG_TARGET_AM
+  IFDEF(CONFIG_HAS_KEYBOARD, key_script_update());
+
   SDL_Event event;
   while (SDL_PollEvent(&event)) {
     switch (event.type) {
       case SDL_QUIT:
         nemu_state.state = NEMU_QUIT;
         break;
-#ifdef CONFIG_HAS_KEYBOARD
+#if defined(CONFIG_HAS_KEYBOARD) && !defined(CONFIG_DEVICE_DETERMINISTIC)
       // If a key was pressed
       case SDL_KEYDOWN:
       case SDL_KEYUP: {
@@ -49,6 +74,7 @@ void device_update() {
     }
   }
 #endif
+  EVENT_END("device_update");
 }
 
 void sdl_clear_event_queue() {
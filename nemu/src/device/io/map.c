@@ -3,7 +3,7 @@
 #include <memory/vaddr.h>
 #include <device/map.h>
 
-#define IO_SPACE_MAX (2 * 1024 * 1024)
+#define IO_SPACE_MAX (2 * 1024 * 1024 + MUXDEF(CONFIG_VGA_ACCEL, CONFIG_GPU_MEM_SIZE, 0))
 
 static uint8_t *io_space = NULL;
 static uint8_t *p_space = NULL;
@@ -17,6 +17,12 @@ uint8_t* new_space(int size) {
   return p;
 }
 
+// the spaces allocated by new_space() are contiguous
+uint8_t* io_space_used(int *size) {
+  *size = p_space - io_space;
+  return io_space;
+}
+
 static void check_bound(IOMap *map, paddr_t addr) {
   if (map == NULL) {
     Assert(map != NULL, "address (" FMT_PADDR ") is out of bound at pc = " FMT_WORD, addr, cpu.pc);
@@ -27,8 +33,12 @@ static void check_bound(IOMap *map, paddr_t addr) {
   }
 }
 
-static void invoke_callback(io_callback_t c, paddr_t offset, int len, bool is_write) {
-  if (c != NULL) { c(offset, len, is_write); }
+static void invoke_callback(IOMap *map, paddr_t offset, int len, bool is_write) {
+  if (map->callback != NULL) {
+    EVENT_BEGIN(map->name);
+    map->callback(offset, len, is_write);
+    EVENT_END(map->name);
+  }
 }
 
 void init_map() {
@@ -41,7 +51,7 @@ word_t map_read(paddr_t addr, int len, IOMap *map) {
   assert(len >= 1 && len <= 8);
   check_bound(map, addr);
   paddr_t offset = addr - map->low;
-  invoke_callback(map->callback, offset, len, false); // prepare data to read
+  invoke_callback(map, offset, len, false); // prepare data to read
   word_t ret = host_read(map->space + offset, len);
   return ret;
 }
@@ -51,5 +61,5 @@ void map_write(paddr_t addr, int len, word_t data, IOMap *map) {
   check_bound(map, addr);
   paddr_t offset = addr - map->low;
   host_write(map->space + offset, len, data);
-  invoke_callback(map->callback, offset, len, true);
+  invoke_callback(map, offset, len, true);
 }
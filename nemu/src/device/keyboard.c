@@ -1,5 +1,6 @@
 #include <device/map.h>
 #include <utils.h>
+#include <inttypes.h>
 
 #define KEYDOWN_MASK 0x8000
 
@@ -30,22 +31,50 @@ static void init_keymap() {
   MAP(_KEYS, SDL_KEYMAP)
 }
 
-#define KEY_QUEUE_LEN 1024
-static int key_queue[KEY_QUEUE_LEN] = {};
-static int key_f = 0, key_r = 0;
+/* The key queue is a lock-free single-producer single-consumer ring buffer.
+ * `key_r` is only written by the producer (send_key() and the key script),
+ * and `key_f` is only written by the consumer (the i8042 data port).
+ * The indices are free-running and wrap around naturally.
+ */
+#define KEY_QUEUE_LEN 1024 // must be a power of 2
+// slots only available to key-up events, so that no key gets stuck
+// when key-down events are dropped because the queue is nearly full
+#define KEY_QUEUE_RESERVE 16
+static uint32_t key_queue[KEY_QUEUE_LEN] = {};
+static uint32_t key_f = 0, key_r = 0;
+
+static struct {
+  uint64_t enqueue, dequeue, coalesce, drop;
+} key_stat = {};
 
 static void key_enqueue(uint32_t am_scancode) {
-  key_queue[key_r] = am_scancode;
-  key_r = (key_r + 1) % KEY_QUEUE_LEN;
-  Assert(key_r != key_f, "key queue overflow!");
+  uint32_t r = key_r;
+  uint32_t used = r - __atomic_load_n(&key_f, __ATOMIC_ACQUIRE);
+  bool is_keydown = (am_scancode & KEYDOWN_MASK) != 0;
+
+  // coalesce the auto-repeated key-down event with the pending one;
+  // it is harmless if the pending one has just been consumed
+  if (is_keydown && used > 0 && key_queue[(r - 1) % KEY_QUEUE_LEN] == am_scancode) {
+    key_stat.coalesce ++;
+    return;
+  }
+
+  if (used >= (is_keydown ? KEY_QUEUE_LEN - KEY_QUEUE_RESERVE : KEY_QUEUE_LEN)) {
+    key_stat.drop ++;
+    return;
+  }
+
+  key_queue[r % KEY_QUEUE_LEN] = am_scancode;
+  __atomic_store_n(&key_r, r + 1, __ATOMIC_RELEASE);
+  key_stat.enqueue ++;
 }
 
 static uint32_t key_dequeue() {
-  uint32_t key = _KEY_NONE;
-  if (key_f != key_r) {
-    key = key_queue[key_f];
-    key_f = (key_f + 1) % KEY_QUEUE_LEN;
-  }
+  uint32_t f = key_f;
+  if (f == __atomic_load_n(&key_r, __ATOMIC_ACQUIRE)) return _KEY_NONE;
+  uint32_t key = key_queue[f % KEY_QUEUE_LEN];
+  __atomic_store_n(&key_f, f + 1, __ATOMIC_RELEASE);
+  key_stat.dequeue ++;
   return key;
 }
 
@@ -55,6 +84,75 @@ void send_key(uint8_t scancode, bool is_keydown) {
     key_enqueue(am_scancode);
   }
 }
+
+void key_statistic() {
+  if (key_stat.enqueue + key_stat.coalesce + key_stat.drop == 0) return;
+  Log("key events: enqueued = %" PRIu64 ", dequeued = %" PRIu64
+      ", coalesced = %" PRIu64 ", dropped = %" PRIu64,
+      key_stat.enqueue, key_stat.dequeue, key_stat.coalesce, key_stat.drop);
+}
+
+/* The key script feeds recorded key events to the guest without SDL,
+ * which is useful to benchmark interactive programs in batch mode.
+ * Each line of the script is
+ *   INSTR KEY down|up
+ * where INSTR is the number of guest instructions executed before the
+ * event is sent, and KEY is the name of the key (e.g. A, RETURN, F1).
+ * INSTR should be non-decreasing. Lines beginning with '#' are ignored.
+ */
+#define _KEY_STR(k) str(k),
+static const char *keyname[] = { "NONE", MAP(_KEYS, _KEY_STR) };
+
+typedef struct {
+  uint64_t instr;
+  uint32_t am_scancode;
+} KeyEvent;
+
+static KeyEvent *script = NULL;
+static int nr_script = 0, script_idx = 0;
+
+static uint32_t key_str2code(const char *name) {
+  for (int i = 1; i < ARRLEN(keyname); i ++) {
+    if (strcmp(name, keyname[i]) == 0) return i;
+  }
+  return _KEY_NONE;
+}
+
+void init_key_script(const char *file) {
+  if (file == NULL) return;
+  FILE *fp = fopen(file, "r");
+  Assert(fp, "Can not open '%s'", file);
+
+  int size = 0, lineno = 0;
+  char line[128], name[32], action[8];
+  uint64_t instr, last = 0;
+  while (fgets(line, sizeof(line), fp) != NULL) {
+    lineno ++;
+    if (line[0] == '#' || line[0] == '\n') continue;
+    int ret = sscanf(line, "%" SCNu64 " %31s %7s", &instr, name, action);
+    uint32_t code = (ret == 3 ? key_str2code(name) : _KEY_NONE);
+    Assert(code != _KEY_NONE && instr >= last &&
+        (strcmp(action, "down") == 0 || strcmp(action, "up") == 0),
+        "%s:%d: bad key event: %s", file, lineno, line);
+    if (nr_script == size) {
+      size = (size == 0 ? 64 : size * 2);
+      script = realloc(script, sizeof(script[0]) * size);
+      assert(script);
+    }
+    script[nr_script ++] = (KeyEvent) { .instr = instr,
+      .am_scancode = code | (strcmp(action, "down") == 0 ? KEYDOWN_MASK : 0) };
+    last = instr;
+  }
+  fclose(fp);
+  Log("Load %d key events from %s", nr_script, file);
+}
+
+void key_script_update() {
+  extern uint64_t g_nr_guest_instr;
+  while (script_idx < nr_script && script[script_idx].instr <= g_nr_guest_instr) {
+    key_enqueue(script[script_idx ++].am_scancode);
+  }
+}
 #else // !CONFIG_TARGET_AM
 #define _KEY_NONE 0
 
@@ -63,6 +161,8 @@ static uint32_t key_dequeue() {
   uint32_t am_scancode = ev.keycode | (ev.keydown ? KEYDOWN_MASK : 0);
   return am_scancode;
 }
+
+void key_statistic() {}
 #endif
 
 static uint32_t *i8042_data_port_base = NULL;
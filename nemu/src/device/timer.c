@@ -7,14 +7,14 @@ static uint32_t *rtc_port_base = NULL;
 static void rtc_io_handler(uint32_t offset, int len, bool is_write) {
   assert(offset == 0 || offset == 4);
   if (!is_write && offset == 4) {
-    uint64_t us = get_time();
+    uint64_t us = device_time();
     rtc_port_base[0] = (uint32_t)us;
     rtc_port_base[1] = us >> 32;
   }
 }
 
 #ifndef CONFIG_TARGET_AM
-static void timer_intr() {
+void timer_intr() {
   if (nemu_state.state == NEMU_RUNNING) {
     extern void dev_raise_intr();
     dev_raise_intr();
@@ -29,5 +29,7 @@ void init_timer() {
 #else
   add_mmio_map("rtc", CONFIG_RTC_MMIO, rtc_port_base, 8, rtc_io_handler);
 #endif
-  IFNDEF(CONFIG_TARGET_AM, add_alarm_handle(timer_intr));
+#if !defined(CONFIG_TARGET_AM) && !defined(CONFIG_DEVICE_DETERMINISTIC)
+  add_alarm_handle(timer_intr);
+#endif
 }
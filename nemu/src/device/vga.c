@@ -1,5 +1,6 @@
 #include <common.h>
 #include <device/map.h>
+#include <memory/paddr.h>
 
 #define SCREEN_W (MUXDEF(CONFIG_VGA_SIZE_800x600, 800, 400))
 #define SCREEN_H (MUXDEF(CONFIG_VGA_SIZE_800x600, 600, 300))
@@ -16,6 +17,21 @@ static uint32_t screen_size() {
   return screen_width() * screen_height() * sizeof(uint32_t);
 }
 
+enum {
+  reg_size,
+  reg_sync,
+  reg_vmemsz, // 0 if 2D acceleration is not supported
+#ifdef CONFIG_VGA_ACCEL
+  reg_cmd,
+  reg_arg0,
+  reg_arg1,
+  reg_arg2,
+  reg_arg3,
+  reg_arg4,
+#endif
+  nr_reg
+};
+
 static void *vmem = NULL;
 static uint32_t *vgactl_port_base = NULL;
 
@@ -55,19 +71,165 @@ static inline void update_screen() {
 #endif
 #endif
 
+#ifdef CONFIG_VGA_ACCEL
+/* 2D acceleration. The guest fills the argument registers and then writes
+ * a command to `reg_cmd`. The command is executed on the host side, so the
+ * pixels are moved by the host memcpy() instead of guest store loops.
+ *
+ *   GPU_CMD_BLIT:   arg0 = x, arg1 = y, arg2 = paddr of pixels, arg3 = w, arg4 = h
+ *   GPU_CMD_MEMCPY: arg0 = dest (offset in GPU memory), arg1 = paddr of src, arg2 = size
+ *   GPU_CMD_RENDER: arg0 = root (offset of a canvas in GPU memory)
+ *
+ * The canvas tree follows the layout of `struct gpu_canvas` in AM,
+ * see abstract-machine/am/include/amdev.h for more details.
+ */
+enum { GPU_CMD_NONE, GPU_CMD_BLIT, GPU_CMD_MEMCPY, GPU_CMD_RENDER };
+
+#define GPU_TEXTURE 1
+#define GPU_SUBTREE 2
+#define GPU_NULL    0xffffffffu
+#define GPU_MAX_DEPTH 16
+
+typedef struct {
+  uint16_t type, w, h, x1, y1, w1, h1;
+  uint32_t sibling;
+  union {
+    uint32_t child;
+    struct {
+      uint16_t w, h;
+      uint32_t pixels;
+    } __attribute__((packed)) texture;
+  };
+} __attribute__((packed)) Canvas;
+
+static uint8_t *gpu_mem = NULL;
+static uint32_t *vbuf = NULL, *vbuf_head = NULL;
+
+static void *gpu_to_host(uint32_t ptr, uint64_t len) {
+  if (ptr == GPU_NULL || (uint64_t)ptr + len > CONFIG_GPU_MEM_SIZE) return NULL;
+  return gpu_mem + ptr;
+}
+
+static void *guest_to_host_range(paddr_t addr, uint64_t len) {
+  if (len == 0 || len > CONFIG_MSIZE || !in_pmem(addr) || !in_pmem(addr + len - 1)) return NULL;
+  return guest_to_host(addr);
+}
+
+static uint32_t *vbuf_alloc(uint64_t npixel) {
+  uint32_t *ret = vbuf_head;
+  if (npixel > vbuf + CONFIG_GPU_MEM_SIZE / sizeof(uint32_t) - vbuf_head) return NULL;
+  vbuf_head += npixel;
+  memset(ret, 0, npixel * sizeof(uint32_t));
+  return ret;
+}
+
+// draw the `w * h` pixels at `src` to the rectangle (x, y) - (x + dw, y + dh)
+// in `dst` of `W * H` pixels, scaling and clipping if necessary
+static void blit(uint32_t *dst, int W, int H, int x, int y, int dw, int dh,
+    const uint32_t *src, int w, int h) {
+  if (w == 0 || h == 0) return;
+  int i0 = (x < 0 ? -x : 0), i1 = (x + dw > W ? W - x : dw);
+  int j0 = (y < 0 ? -y : 0), j1 = (y + dh > H ? H - y : dh);
+  if (i0 >= i1 || j0 >= j1) return;
+  for (int j = j0; j < j1; j ++) {
+    uint32_t *d = dst + (y + j) * W + x;
+    const uint32_t *s = src + (dh == h ? j : (int64_t)j * h / dh) * w;
+    if (dw == w) memcpy(d + i0, s + i0, (i1 - i0) * sizeof(uint32_t));
+    else for (int i = i0; i < i1; i ++) d[i] = s[(int64_t)i * w / dw];
+  }
+}
+
+static void render(Canvas *cv, uint32_t *px, int W, int H, int depth) {
+  const uint32_t *px_local = NULL;
+  int w = 0, h = 0;
+
+  switch (cv->type) {
+    case GPU_TEXTURE:
+      w = cv->texture.w; h = cv->texture.h;
+      px_local = gpu_to_host(cv->texture.pixels, (uint64_t)w * h * sizeof(uint32_t));
+      break;
+    case GPU_SUBTREE: {
+      if (depth >= GPU_MAX_DEPTH) break;
+      w = cv->w; h = cv->h;
+      uint32_t *buf = vbuf_alloc((uint64_t)w * h);
+      if (buf == NULL) break;
+      Canvas *ch;
+      uint32_t ptr;
+      int n = 0;
+      for (ptr = cv->child; (ch = gpu_to_host(ptr, sizeof(Canvas))) != NULL; ptr = ch->sibling) {
+        if (++ n > CONFIG_GPU_MEM_SIZE / sizeof(Canvas)) break; // loop in the sibling list
+        render(ch, buf, w, h, depth + 1);
+      }
+      px_local = buf;
+      break;
+    }
+    default: break;
+  }
+
+  if (px_local == NULL) {
+    Log("vga: ignore bad canvas (type = %d) in the render tree", cv->type);
+    return;
+  }
+  blit(px, W, H, cv->x1, cv->y1, cv->w1, cv->h1, px_local, w, h);
+}
+
+static void vga_cmd_exec(uint32_t cmd, uint32_t *arg) {
+  switch (cmd) {
+    case GPU_CMD_BLIT: {
+      int w = arg[3], h = arg[4];
+      uint32_t *pixels = guest_to_host_range(arg[2], (uint64_t)w * h * sizeof(uint32_t));
+      if (pixels != NULL) blit(vmem, screen_width(), screen_height(), arg[0], arg[1], w, h, pixels, w, h);
+      break;
+    }
+    case GPU_CMD_MEMCPY: {
+      uint8_t *dst = gpu_to_host(arg[0], arg[2]);
+      uint8_t *src = guest_to_host_range(arg[1], arg[2]);
+      if (dst != NULL && src != NULL) memcpy(dst, src, arg[2]);
+      break;
+    }
+    case GPU_CMD_RENDER: {
+      Canvas *root = gpu_to_host(arg[0], sizeof(Canvas));
+      vbuf_head = vbuf;
+      if (root != NULL) render(root, vmem, screen_width(), screen_height(), 0);
+      break;
+    }
+    default: Log("vga: unsupported command %d", cmd); break;
+  }
+}
+
+static void vga_io_handler(uint32_t offset, int len, bool is_write) {
+  if (is_write && offset == reg_cmd * sizeof(uint32_t)) {
+    vga_cmd_exec(vgactl_port_base[reg_cmd], &vgactl_port_base[reg_arg0]);
+    vgactl_port_base[reg_cmd] = GPU_CMD_NONE;
+  }
+}
+
+static void init_vga_accel() {
+  vgactl_port_base[reg_vmemsz] = CONFIG_GPU_MEM_SIZE;
+  gpu_mem = new_space(CONFIG_GPU_MEM_SIZE);
+  vbuf = malloc(CONFIG_GPU_MEM_SIZE);
+  assert(vbuf);
+}
+#endif
+
 void vga_update_screen() {
-  // TODO: call `update_screen()` when the sync register is non-zero,
-  // then zero out the sync register
+  if (vgactl_port_base[reg_sync]) {
+    IFDEF(CONFIG_VGA_SHOW_SCREEN, update_screen());
+    vgactl_port_base[reg_sync] = 0;
+  }
 }
 
 void init_vga() {
-  vgactl_port_base = (uint32_t *)new_space(8);
-  vgactl_port_base[0] = (screen_width() << 16) | screen_height();
+  uint32_t space_size = sizeof(uint32_t) * nr_reg;
+  io_callback_t handler = MUXDEF(CONFIG_VGA_ACCEL, vga_io_handler, NULL);
+  vgactl_port_base = (uint32_t *)new_space(space_size);
+  vgactl_port_base[reg_size] = (screen_width() << 16) | screen_height();
 #ifdef CONFIG_HAS_PORT_IO
-  add_pio_map ("vgactl", CONFIG_VGA_CTL_PORT, vgactl_port_base, 8, NULL);
+  add_pio_map ("vgactl", CONFIG_VGA_CTL_PORT, vgactl_port_base, space_size, handler);
 #else
-  add_mmio_map("vgactl", CONFIG_VGA_CTL_MMIO, vgactl_port_base, 8, NULL);
+  add_mmio_map("vgactl", CONFIG_VGA_CTL_MMIO, vgactl_port_base, space_size, handler);
 #endif
+  IFDEF(CONFIG_VGA_ACCEL, init_vga_accel());
 
   vmem = new_space(screen_size());
   add_mmio_map("vmem", CONFIG_FB_ADDR, vmem, screen_size(), NULL);
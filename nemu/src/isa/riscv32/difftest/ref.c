@@ -0,0 +1,12 @@
+#include <isa.h>
+#include <cpu/difftest.h>
+#include <difftest-def.h>
+
+void isa_difftest_regcpy(void *dut, bool direction) {
+  if (direction == DIFFTEST_TO_REF) memcpy(&cpu, dut, DIFFTEST_REG_SIZE);
+  else memcpy(dut, &cpu, DIFFTEST_REG_SIZE);
+}
+
+void isa_difftest_raise_intr(word_t NO) {
+  cpu.pc = isa_raise_intr(NO, cpu.pc);
+}
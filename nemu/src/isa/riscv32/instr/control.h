@@ -1,10 +1,23 @@
+// x1 (ra) and x5 (t0) are the link registers in the calling convention
+#define is_link(r) ((r) == 1 || (r) == 5)
+
 def_EHelper(jal) {
+#ifdef CONFIG_FTRACE
+  if (is_link(s->isa.instr.j.rd)) ftrace_call(s->pc, s->pc + id_src1->simm);
+  else if (s->isa.instr.j.rd == 0) ftrace_jump(s->pc, s->pc + id_src1->simm);
+#endif
   rtl_j(s, s->pc + id_src1->simm);
   rtl_li(s, ddest, s->pc + 4);
 }
 
 def_EHelper(jalr) {
   vaddr_t target = (*(id_src1->preg) + id_src2->simm) & ((~0) << 1);
+#ifdef CONFIG_FTRACE
+  int rd = s->isa.instr.i.rd, rs1 = s->isa.instr.i.rs1;
+  if (is_link(rd)) ftrace_call(s->pc, target);
+  else if (rd == 0 && is_link(rs1)) ftrace_ret(s->pc, target);
+  else if (rd == 0) ftrace_jump(s->pc, target);
+#endif
   rtl_j(s, target);
   rtl_li(s, ddest, s->pc + 4);
 }
\ No newline at end of file
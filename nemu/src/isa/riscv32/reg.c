@@ -15,19 +15,28 @@ void isa_reg_display() {
     printf("pc \t0x%08x \t%d\n", cpu.pc, cpu.pc);
 }
 
-word_t isa_reg_str2val(const char *s, bool *success) {
+// return the address of the register, so that it can be read without lookup
+word_t* isa_reg_str2ptr(const char *s) {
   if (strcmp(s, reg_name(0, 32)) == 0) {
-    return 0;
+    return &gpr(0);
   }
   if (strcmp(s, "$pc") == 0) {
-    return cpu.pc;
+    return &cpu.pc;
   }
   s++;
   for (int i = 1; i < 32; i++) {
     if (strcmp(s, reg_name(i, 32)) == 0) {
-      return gpr(i);
+      return &gpr(i);
     }
   }
-  *success = false;
-  return 0;
+  return NULL;
+}
+
+word_t isa_reg_str2val(const char *s, bool *success) {
+  word_t *p = isa_reg_str2ptr(s);
+  if (p == NULL) {
+    *success = false;
+    return 0;
+  }
+  return *p;
 }
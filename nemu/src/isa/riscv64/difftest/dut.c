@@ -3,7 +3,11 @@
 #include "../local-include/reg.h"
 
 bool isa_difftest_checkregs(CPU_state *ref_r, vaddr_t pc) {
-  return false;
+  int i;
+  for (i = 0; i < 32; i ++) {
+    if (!difftest_check_reg(reg_name(i, 64), pc, ref_r->gpr[i]._64, gpr(i))) return false;
+  }
+  return difftest_check_reg("pc", pc, ref_r->pc, cpu.pc);
 }
 
 void isa_difftest_attach() {
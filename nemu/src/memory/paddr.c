@@ -1,7 +1,9 @@
 #include <memory/host.h>
 #include <memory/paddr.h>
 #include <device/mmio.h>
+#include <cpu/difftest.h>
 #include <isa.h>
+#include <mtrace-def.h>
 
 #if   defined(CONFIG_TARGET_AM)
 static uint8_t *pmem = NULL;
@@ -9,6 +11,11 @@ static uint8_t *pmem = NULL;
 static uint8_t pmem[CONFIG_MSIZE] PG_ALIGN = {};
 #endif
 
+// the number of memory watchpoints in each page
+#define WATCH_PAGE_SHIFT 12
+static int watch_cnt[CONFIG_MSIZE >> WATCH_PAGE_SHIFT] = {};
+static bool is_watch_hit = false;
+
 uint8_t* guest_to_host(paddr_t paddr) { return pmem + paddr - CONFIG_MBASE; }
 paddr_t host_to_guest(uint8_t *haddr) { return haddr - pmem + CONFIG_MBASE; }
 
@@ -21,31 +28,112 @@ static void pmem_write(paddr_t addr, int len, word_t data) {
   host_write(guest_to_host(addr), len, data);
 }
 
+// fill `p` with the initial values of `len` bytes of pmem from `offset`,
+// which are multiples of 4
+static void fill_init(uint32_t *p, long offset, long len) {
+#ifdef CONFIG_MEM_RANDOM
+  // a hash of the index rather than rand(), so that the values can be
+  // computed again to tell the pages written since initialization
+  uint32_t i = offset / sizeof(p[0]);
+  uint32_t *end = p + len / sizeof(p[0]);
+  for (; p < end; p ++, i ++) {
+    uint32_t x = i * 0x9e3779b9u;
+    x = (x ^ (x >> 16)) * 0x85ebca6bu;
+    x = (x ^ (x >> 13)) * 0xc2b2ae35u;
+    *p = x ^ (x >> 16);
+  }
+#else
+  memset(p, 0, len);
+#endif
+}
+
 void init_mem() {
 #if   defined(CONFIG_TARGET_AM)
   pmem = malloc(CONFIG_MSIZE);
   assert(pmem);
 #endif
-#ifdef CONFIG_MEM_RANDOM
-  uint32_t *p = (uint32_t *)pmem;
-  int i;
-  for (i = 0; i < (int) (CONFIG_MSIZE / sizeof(p[0])); i ++) {
-    p[i] = rand();
-  }
-#endif
+  IFDEF(CONFIG_MEM_RANDOM, fill_init((uint32_t *)pmem, 0, CONFIG_MSIZE));
   Log("physical memory area [" FMT_PADDR ", " FMT_PADDR "]",
       (paddr_t)CONFIG_MBASE, (paddr_t)CONFIG_MBASE + CONFIG_MSIZE);
 }
 
-word_t paddr_read(paddr_t addr, int len) {
+static inline int watch_idx(paddr_t addr) {
+  return (addr - CONFIG_MBASE) >> WATCH_PAGE_SHIFT;
+}
+
+void paddr_watch(paddr_t addr, int len, bool enable) {
+  assert(in_pmem(addr) && in_pmem(addr + len - 1));
+  // a store is at most 8 bytes, and only its first byte is checked,
+  // so also mark the previous page for the stores crossing pages
+  paddr_t start = (addr - CONFIG_MBASE >= 7 ? addr - 7 : CONFIG_MBASE);
+  int i;
+  for (i = watch_idx(start); i <= watch_idx(addr + len - 1); i ++) {
+    watch_cnt[i] += (enable ? 1 : -1);
+  }
+}
+
+bool paddr_watch_hit() {
+  bool ret = is_watch_hit;
+  is_watch_hit = false;
+  return ret;
+}
+
+void paddr_reset() {
+  fill_init((uint32_t *)pmem, 0, CONFIG_MSIZE);
+}
+
+bool paddr_is_dirty(paddr_t addr) {
+  static uint32_t page[(1 << WATCH_PAGE_SHIFT) / sizeof(uint32_t)];
+  long offset = (long)watch_idx(addr) << WATCH_PAGE_SHIFT;
+  fill_init(page, offset, sizeof(page));
+  return memcmp(pmem + offset, page, sizeof(page)) != 0;
+}
+
+#ifdef CONFIG_MTRACE
+#define MTRACE_TYPE (MUXDEF(CONFIG_MTRACE_READ, MTRACE_READ, 0) | \
+    MUXDEF(CONFIG_MTRACE_WRITE, MTRACE_WRITE, 0) | MUXDEF(CONFIG_MTRACE_FETCH, MTRACE_FETCH, 0))
+void mtrace_record(paddr_t addr, int len, int type, word_t data);
+
+// filter the accesses before recording them
+static inline void mtrace(paddr_t addr, int len, int type, word_t data) {
+  if ((type & MTRACE_TYPE) && (uint64_t)addr >= CONFIG_MTRACE_START &&
+      (uint64_t)addr <= CONFIG_MTRACE_END) {
+    mtrace_record(addr, len, type, data);
+  }
+}
+#endif
+
+static inline word_t read_internal(paddr_t addr, int len) {
   if (likely(in_pmem(addr))) return pmem_read(addr, len);
   MUXDEF(CONFIG_DEVICE, return mmio_read(addr, len),
     panic("address = " FMT_PADDR " is out of bound of pmem [" FMT_PADDR ", " FMT_PADDR ") at pc = " FMT_WORD,
       addr, CONFIG_MBASE, CONFIG_MBASE + CONFIG_MSIZE, cpu.pc));
 }
 
+word_t paddr_read(paddr_t addr, int len) {
+  word_t ret = read_internal(addr, len);
+  IFDEF(CONFIG_MTRACE, mtrace(addr, len, MTRACE_READ, ret));
+  return ret;
+}
+
+word_t paddr_ifetch(paddr_t addr, int len) {
+  word_t ret = read_internal(addr, len);
+  IFDEF(CONFIG_MTRACE, mtrace(addr, len, MTRACE_FETCH, ret));
+  return ret;
+}
+
+word_t paddr_peek(paddr_t addr, int len) {
+  return read_internal(addr, len);
+}
+
 void paddr_write(paddr_t addr, int len, word_t data) {
-  if (likely(in_pmem(addr))) { pmem_write(addr, len, data); return; }
+  IFDEF(CONFIG_MTRACE, mtrace(addr, len, MTRACE_WRITE, data));
+  if (likely(in_pmem(addr))) {
+    difftest_log_store(addr, len);
+    if (unlikely(watch_cnt[watch_idx(addr)])) is_watch_hit = true;
+    pmem_write(addr, len, data);
+    return;
+  }
   MUXDEF(CONFIG_DEVICE, mmio_write(addr, len, data),
     panic("address = " FMT_PADDR " is out of bound of pmem [" FMT_PADDR ", " FMT_PADDR ") at pc = " FMT_WORD,
       addr, CONFIG_MBASE, CONFIG_MBASE + CONFIG_MSIZE, cpu.pc));
@@ -3,13 +3,29 @@
 
 // len can only be 1, 2 or 4 (bytes)
 word_t vaddr_ifetch(vaddr_t addr, int len) {
-  return paddr_read(addr, len);
+  return paddr_ifetch(addr, len);
 }
 
 word_t vaddr_read(vaddr_t addr, int len) {
+  if (unlikely(g_perf_mem)) {
+    uint64_t t = perf_cycles();
+    word_t ret = paddr_read(addr, len);
+    g_perf_cycles[PERF_MEM] += perf_cycles() - t;
+    return ret;
+  }
   return paddr_read(addr, len);
 }
 
+word_t vaddr_peek(vaddr_t addr, int len) {
+  return paddr_peek(addr, len);
+}
+
 void vaddr_write(vaddr_t addr, int len, word_t data) {
+  if (unlikely(g_perf_mem)) {
+    uint64_t t = perf_cycles();
+    paddr_write(addr, len, data);
+    g_perf_cycles[PERF_MEM] += perf_cycles() - t;
+    return;
+  }
   paddr_write(addr, len, data);
 }
@@ -5,9 +5,16 @@ void init_rand();
 void init_log(const char *log_file);
 void init_mem();
 void init_difftest(char *ref_so_file, long img_size, int port);
+long load_replay(const char *file);
+bool load_snapshot(const char *file);
 void init_device();
+void init_key_script(const char *file);
 void init_sdb();
 void init_disasm(const char *triple);
+void init_mtrace(const char *file);
+void init_ftrace();
+void init_profile();
+void init_event_trace();
 
 static void welcome() {
   Log("Trace: %s", MUXDEF(CONFIG_TRACE, ASNI_FMT("ON", ASNI_FG_GREEN), ASNI_FMT("OFF", ASNI_FG_RED)));
@@ -25,10 +32,16 @@ static void welcome() {
 #include <getopt.h>
 
 void sdb_set_batch_mode();
+void sdb_set_gdb_port(int port);
+void sdb_set_save_file(char *file);
 
 static char *log_file = NULL;
 static char *diff_so_file = NULL;
 static char *img_file = NULL;
+static char *key_script_file = NULL;
+static char *replay_file = NULL;
+static char *snapshot_file = NULL;
+static char *elf_file = NULL;
 static int difftest_port = 1234;
 
 static long load_img() {
@@ -59,16 +72,30 @@ static int parse_args(int argc, char *argv[]) {
     {"log"      , required_argument, NULL, 'l'},
     {"diff"     , required_argument, NULL, 'd'},
     {"port"     , required_argument, NULL, 'p'},
+    {"keys"     , required_argument, NULL, 'k'},
+    {"replay"   , required_argument, NULL, 'r'},
+    {"gdb-port" , required_argument, NULL, 'g'},
+    {"load"     , required_argument, NULL, 'L'},
+    {"save"     , required_argument, NULL, 'S'},
+    {"elf"      , required_argument, NULL, 'e'},
+    {"perf-stats", no_argument     , NULL, 'P'},
     {"help"     , no_argument      , NULL, 'h'},
     {0          , 0                , NULL,  0 },
   };
   int o;
-  while ( (o = getopt_long(argc, argv, "-bhl:d:p:", table, NULL)) != -1) {
+  while ( (o = getopt_long(argc, argv, "-bhl:d:p:k:r:g:L:S:e:", table, NULL)) != -1) {
     switch (o) {
       case 'b': sdb_set_batch_mode(); break;
       case 'p': sscanf(optarg, "%d", &difftest_port); break;
       case 'l': log_file = optarg; break;
       case 'd': diff_so_file = optarg; break;
+      case 'k': key_script_file = optarg; break;
+      case 'r': replay_file = optarg; break;
+      case 'g': sdb_set_gdb_port(atoi(optarg)); break;
+      case 'L': snapshot_file = optarg; break;
+      case 'S': sdb_set_save_file(optarg); break;
+      case 'e': elf_file = optarg; break;
+      case 'P': g_perf_stats = true; break;
       case 1: img_file = optarg; return optind - 1;
       default:
         printf("Usage: %s [OPTION...] IMAGE [args]\n\n", argv[0]);
@@ -76,6 +103,14 @@ static int parse_args(int argc, char *argv[]) {
         printf("\t-l,--log=FILE           output log to FILE\n");
         printf("\t-d,--diff=REF_SO        run DiffTest with reference REF_SO\n");
         printf("\t-p,--port=PORT          run DiffTest with port PORT\n");
+        printf("\t-k,--keys=FILE          feed the key events recorded in FILE to the guest\n");
+        printf("\t-r,--replay=FILE        replay the instructions recorded in FILE by DiffTest\n"
+               "\t                        (needs CONFIG_DIFFTEST_RING)\n");
+        printf("\t-g,--gdb-port=PORT      wait for gdb to connect at PORT instead of running sdb\n");
+        printf("\t-L,--load=FILE          start from the snapshot in FILE\n");
+        printf("\t-S,--save=FILE          save the snapshot to FILE before exiting\n");
+        printf("\t-e,--elf=FILE           load the function symbols of the guest from FILE\n");
+        printf("\t--perf-stats            report the host time per guest instruction by parts\n");
         printf("\n");
         exit(0);
     }
@@ -95,18 +130,45 @@ void init_monitor(int argc, char *argv[]) {
   /* Open the log file. */
   init_log(log_file);
 
+  /* Open the memory trace. */
+  IFDEF(CONFIG_MTRACE, init_mtrace(CONFIG_MTRACE_FILE));
+
+  /* Start recording the events. */
+  IFDEF(CONFIG_EVENT_TRACE, init_event_trace());
+
   /* Initialize memory. */
   init_mem();
 
   /* Initialize devices. */
   IFDEF(CONFIG_DEVICE, init_device());
 
+  /* Load the key script for the keyboard. */
+  IFDEF(CONFIG_HAS_KEYBOARD, init_key_script(key_script_file));
+
   /* Perform ISA dependent initialization. */
   init_isa();
 
   /* Load the image to memory. This will overwrite the built-in image. */
   long img_size = load_img();
 
+#ifdef CONFIG_DIFFTEST_RING
+  /* Restore the state recorded by a failed differential testing. */
+  if (replay_file != NULL) img_size = load_replay(replay_file);
+#else
+  Assert(replay_file == NULL, "--replay is not supported, enable CONFIG_DIFFTEST_RING to use it");
+#endif
+
+  /* Restore the machine from a snapshot. */
+  if (snapshot_file != NULL) {
+    if (!load_snapshot(snapshot_file)) exit(1);
+    img_size = CONFIG_MSIZE - CONFIG_PC_RESET_OFFSET;
+  }
+
+  /* Load the symbols of the guest, which are used by ftrace and the profiler. */
+  if (elf_file != NULL) init_symbol(elf_file);
+  IFDEF(CONFIG_FTRACE, init_ftrace());
+  IFDEF(CONFIG_PROFILE, init_profile());
+
   /* Initialize differential testing. */
   init_difftest(diff_so_file, img_size, difftest_port);
 
@@ -0,0 +1,124 @@
+#include "sdb.h"
+
+/* Breakpoints are kept in an open-addressing hash set of PCs with linear
+ * probing, so that checking a PC costs only a few memory accesses.
+ * The table is kept at most half full to keep the probing sequences short.
+ */
+#define BP_TABLE_BITS 8
+#define BP_TABLE_SIZE (1 << BP_TABLE_BITS)
+static_assert(NR_BP == BP_TABLE_SIZE / 2, "NR_BP should be half of the table size");
+
+enum { BP_EMPTY, BP_USED, BP_DELETED };
+
+static struct {
+  vaddr_t pc;
+  uint8_t state;
+} bp_table[BP_TABLE_SIZE] = {};
+
+// checked by cpu_exec() before looking up the table
+int g_nr_bp = 0;
+static int nr_deleted = 0;
+
+static inline uint32_t bp_hash(vaddr_t pc) {
+  // the lowest bit of PC is zero in most ISAs
+  return ((uint32_t)(pc >> 1) * 2654435761u) >> (32 - BP_TABLE_BITS);
+}
+
+// return the slot of `pc`, or -1 if it is not in the table
+static int find_bp(vaddr_t pc) {
+  uint32_t i = bp_hash(pc);
+  while (bp_table[i].state != BP_EMPTY) {
+    if (bp_table[i].state == BP_USED && bp_table[i].pc == pc) {
+      return i;
+    }
+    i = (i + 1) & (BP_TABLE_SIZE - 1);
+  }
+  return -1;
+}
+
+// rebuild the table to clean the deleted slots
+static void rehash() {
+  vaddr_t pcs[NR_BP];
+  int i, n = 0;
+  for (i = 0; i < BP_TABLE_SIZE; i ++) {
+    if (bp_table[i].state == BP_USED) {
+      pcs[n ++] = bp_table[i].pc;
+    }
+    bp_table[i].state = BP_EMPTY;
+  }
+  g_nr_bp = 0;
+  nr_deleted = 0;
+  for (i = 0; i < n; i ++) {
+    add_bp(pcs[i]);
+  }
+}
+
+bool check_bp(vaddr_t pc) {
+  return find_bp(pc) >= 0;
+}
+
+int add_bp(vaddr_t pc) {
+  if (find_bp(pc) >= 0) {
+    return 1;
+  }
+  if (g_nr_bp == NR_BP) {
+    return 2;
+  }
+  if (g_nr_bp + nr_deleted == NR_BP) {
+    rehash();
+  }
+
+  uint32_t i = bp_hash(pc);
+  while (bp_table[i].state == BP_USED) {
+    i = (i + 1) & (BP_TABLE_SIZE - 1);
+  }
+  if (bp_table[i].state == BP_DELETED) {
+    nr_deleted --;
+  }
+  bp_table[i].pc = pc;
+  bp_table[i].state = BP_USED;
+  g_nr_bp ++;
+  return 0;
+}
+
+int del_bp(vaddr_t pc) {
+  int i = find_bp(pc);
+  if (i < 0) {
+    return 1;
+  }
+  // keep the probing sequences passing through this slot
+  bp_table[i].state = BP_DELETED;
+  g_nr_bp --;
+  nr_deleted ++;
+  return 0;
+}
+
+// copy the breakpoints to `pcs`, return the number of them
+int get_bps(vaddr_t *pcs) {
+  int i, n = 0;
+  for (i = 0; i < BP_TABLE_SIZE; i ++) {
+    if (bp_table[i].state == BP_USED) {
+      pcs[n ++] = bp_table[i].pc;
+    }
+  }
+  return n;
+}
+
+void clear_bps() {
+  memset(bp_table, 0, sizeof(bp_table));
+  g_nr_bp = 0;
+  nr_deleted = 0;
+}
+
+void display_bp() {
+  if (g_nr_bp == 0) {
+    printf("There is no breakpoint set.\n");
+    return;
+  }
+  printf("%8s\n", "ADDR");
+  for (int i = 0; i < BP_TABLE_SIZE; i ++) {
+    if (bp_table[i].state == BP_USED) {
+      printf("  " FMT_WORD "\n", bp_table[i].pc);
+    }
+  }
+}
@@ -0,0 +1,387 @@
+#include <isa.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <cpu/cpu.h>
+#include "sdb.h"
+
+/* Checkpoints by fork(). A checkpoint is a child process which is parked
+ * right after fork(), sharing the memory with its parent copy-on-write,
+ * so taking a checkpoint costs little no matter how large the guest is.
+ * To restart a checkpoint, it is woken by SIGUSR1, and it forks again:
+ * the new child becomes the active process to run the guest, while the
+ * checkpoint itself stays parked to be restarted later.
+ *
+ * The process launched by the user (the root) keeps the terminal. Once
+ * it is replaced by another process, it waits for the active process to
+ * exit, and exits with the same status. The table of checkpoints is
+ * shared by all these processes. Only the active process exits by exit(),
+ * the others use _exit(), so that the exit handlers (e.g. dumping the
+ * traces) do not run with a stale state.
+ *
+ * Only the state of this process is saved, so the host-side states of
+ * the devices (e.g. the SDL window) and an out-of-process REF of
+ * DiffTest can not be restored by checkpoints.
+ *
+ * Reverse execution is built on them: to go back to an earlier point,
+ * the nearest checkpoint before it is restarted, and re-executes the
+ * guest up to the number of instructions of that point. This requires
+ * the execution to be deterministic, see CONFIG_DEVICE_DETERMINISTIC.
+ */
+
+#define NR_CKPT 32
+// a parked checkpoint checks whether the root is still alive in this period
+#define PARK_CHECK_SEC 1
+
+typedef struct {
+  pid_t pid; // 0 if the slot is free
+  uint64_t nr_instr;
+  vaddr_t pc;
+  bool is_auto;
+} Checkpoint;
+
+enum { REV_NONE, REV_STEP, REV_CONTINUE };
+
+static struct {
+  Checkpoint ckpt[NR_CKPT];
+  pid_t root;
+  pid_t active; // 0 when a checkpoint is being restarted
+  bool is_exit;
+  int exit_status;
+  // the reverse execution for the restarted checkpoint to finish
+  int rev_mode;
+  uint64_t rev_goal;
+  // breakpoints and watchpoints are not restored by checkpoints,
+  // but passed to the restarted one
+  int nr_bp, nr_wp;
+  vaddr_t bp[NR_BP];
+  char wp[NR_WP][WP_EXPR_LEN];
+  int wp_len[NR_WP];
+} *shared = NULL;
+
+extern uint64_t g_nr_guest_instr;
+// checked by cpu_exec() to take checkpoints automatically
+uint64_t g_ckpt_instr = UINT64_MAX;
+static uint64_t ckpt_interval = 0;
+
+int is_exit_status_bad();
+
+static void init_checkpoint() {
+  shared = mmap(NULL, sizeof(*shared), PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  assert(shared != MAP_FAILED);
+  memset(shared, 0, sizeof(*shared));
+  shared->root = shared->active = getpid();
+
+  // SIGUSR1 is only received by sigtimedwait()
+  sigset_t set;
+  sigemptyset(&set);
+  sigaddset(&set, SIGUSR1);
+  sigprocmask(SIG_BLOCK, &set, NULL);
+  // adopt the orphans to reap them
+  prctl(PR_SET_CHILD_SUBREAPER, 1);
+}
+
+static void kill_checkpoints() {
+  int i;
+  for (i = 0; i < NR_CKPT; i ++) {
+    if (shared->ckpt[i].pid != 0) {
+      kill(shared->ckpt[i].pid, SIGKILL);
+      shared->ckpt[i].pid = 0;
+    }
+  }
+}
+
+// wait until being restarted, return in the new active process
+static void park() {
+  sigset_t set;
+  sigemptyset(&set);
+  sigaddset(&set, SIGUSR1);
+  struct timespec timeout = { .tv_sec = PARK_CHECK_SEC, .tv_nsec = 0 };
+  while (true) {
+    if (sigtimedwait(&set, NULL, &timeout) != SIGUSR1) {
+      if (kill(shared->root, 0) != 0) _exit(0);
+      continue;
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+      shared->active = getpid();
+      return;
+    }
+    if (pid < 0) {
+      perror("fork");
+      shared->active = getpid();
+      return;
+    }
+  }
+}
+
+// the root waits for the active process, and never returns
+static void root_wait() {
+  while (!shared->is_exit) {
+    while (waitpid(-1, NULL, WNOHANG) > 0);
+    pid_t active = shared->active;
+    if (active != 0 && kill(active, 0) != 0) {
+      // the active process exits abnormally
+      kill_checkpoints();
+      _exit(1);
+    }
+    usleep(10000);
+  }
+  _exit(shared->exit_status);
+}
+
+static int free_slot() {
+  int id;
+  for (id = 0; id < NR_CKPT && shared->ckpt[id].pid != 0; id ++);
+  return (id == NR_CKPT ? -1 : id);
+}
+
+static void drop_checkpoint(int id) {
+  kill(shared->ckpt[id].pid, SIGKILL);
+  shared->ckpt[id].pid = 0;
+}
+
+// return the ID of the latest checkpoint not after `nr_instr`, or -1
+static int find_checkpoint(uint64_t nr_instr) {
+  int i, id = -1;
+  for (i = 0; i < NR_CKPT; i ++) {
+    Checkpoint *c = &shared->ckpt[i];
+    if (c->pid != 0 && c->nr_instr <= nr_instr &&
+        (id == -1 || c->nr_instr > shared->ckpt[id].nr_instr)) id = i;
+  }
+  return id;
+}
+
+/* Make room for a checkpoint by dropping an older automatic one. The
+ * cost to drop a checkpoint is the gap it leaves between its neighbors,
+ * divided by its age, since the distant past is visited less often.
+ * As a result, the checkpoints get sparser exponentially with the age,
+ * and the ones near the current point are kept dense for short reverse
+ * steps, no matter how long the guest has run. */
+static int thin_checkpoints() {
+  int i, j, victim = -1;
+  double min_cost = 0;
+  for (i = 0; i < NR_CKPT; i ++) {
+    Checkpoint *c = &shared->ckpt[i];
+    if (c->pid == 0 || !c->is_auto) continue;
+    uint64_t prev = 0, next = g_nr_guest_instr;
+    for (j = 0; j < NR_CKPT; j ++) {
+      Checkpoint *d = &shared->ckpt[j];
+      if (d->pid == 0 || j == i) continue;
+      if (d->nr_instr <= c->nr_instr && d->nr_instr > prev) prev = d->nr_instr;
+      if (d->nr_instr > c->nr_instr && d->nr_instr < next) next = d->nr_instr;
+    }
+    double cost = (double)(next - prev) / (g_nr_guest_instr - c->nr_instr + 1);
+    if (victim == -1 || cost < min_cost) {
+      victim = i;
+      min_cost = cost;
+    }
+  }
+  if (victim != -1) drop_checkpoint(victim);
+  return victim;
+}
+
+// return the ID of the checkpoint, or -1 on failure;
+// `*restarted` is set in the process restarted from the checkpoint
+int take_checkpoint(bool is_auto, bool *restarted) {
+  *restarted = false;
+  if (shared == NULL) init_checkpoint();
+
+  int id = free_slot();
+  if (id == -1) id = thin_checkpoints();
+  if (id == -1) {
+    printf("No free slot for a checkpoint, at most %d checkpoints can be taken.\n", NR_CKPT);
+    return -1;
+  }
+
+  // do not let the buffered output be duplicated
+  fflush(stdout);
+#ifdef CONFIG_LOG_ASYNC
+  // the log file belongs to the writer thread, which may be rotating it
+  log_flush();
+#else
+  extern FILE *log_fp;
+  if (log_fp != NULL) fflush(log_fp);
+#endif
+  pid_t pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    return -1;
+  }
+  if (pid == 0) {
+    park();
+    *restarted = true;
+    int i;
+    clear_bps();
+    for (i = 0; i < shared->nr_bp; i ++) add_bp(shared->bp[i]);
+    clear_wps();
+    // get_wps() lists the newest one first
+    for (i = shared->nr_wp - 1; i >= 0; i --) {
+      // the ones from gdb watch `wp_len` bytes at the address in `*ADDR`
+      if (shared->wp_len[i] > 0) add_wp_mem(strtoul(shared->wp[i] + 1, NULL, 16), shared->wp_len[i]);
+      else add_wp(shared->wp[i]);
+    }
+    if (shared->rev_mode == REV_NONE) {
+      printf("Restart from checkpoint %d at pc = " FMT_WORD ".\n", id, cpu.pc);
+    }
+    return id;
+  }
+  shared->ckpt[id] = (Checkpoint) { .pid = pid, .nr_instr = g_nr_guest_instr,
+    .pc = cpu.pc, .is_auto = is_auto };
+  return id;
+}
+
+int restart_checkpoint(int id) {
+  if (shared == NULL || id < 0 || id >= NR_CKPT || shared->ckpt[id].pid == 0) {
+    return 1;
+  }
+  shared->nr_bp = get_bps(shared->bp);
+  shared->nr_wp = get_wps(shared->wp, shared->wp_len);
+  fflush(stdout);
+  shared->active = 0;
+  kill(shared->ckpt[id].pid, SIGUSR1);
+  if (getpid() == shared->root) root_wait();
+  _exit(0);
+}
+
+void set_checkpoint_interval(uint64_t n) {
+  ckpt_interval = n;
+  g_ckpt_instr = (n == 0 ? UINT64_MAX : g_nr_guest_instr + n);
+}
+
+// called by cpu_exec() when `g_ckpt_instr` is reached,
+// return true in the process restarted from the checkpoint
+bool auto_checkpoint() {
+  g_ckpt_instr = g_nr_guest_instr + ckpt_interval;
+  // the guest runs again after going back, and the checkpoints
+  // taken last time can be reused
+  int near = find_checkpoint(g_nr_guest_instr + ckpt_interval / 2);
+  if (near != -1 && shared->ckpt[near].nr_instr + ckpt_interval / 2 > g_nr_guest_instr) {
+    return false;
+  }
+
+  bool restarted;
+  int id = take_checkpoint(true, &restarted);
+  if (id < 0) {
+    printf("Stop taking checkpoints automatically.\n");
+    set_checkpoint_interval(0);
+    return false;
+  }
+  return restarted;
+}
+
+// go back to the point after `nr_instr` instructions by restarting the
+// checkpoint `id`, and do not return
+static void reverse_to(int id, uint64_t nr_instr, int mode) {
+  shared->rev_mode = mode;
+  shared->rev_goal = nr_instr;
+  restart_checkpoint(id);
+}
+
+void reverse_step(uint64_t n) {
+  uint64_t goal = (g_nr_guest_instr > n ? g_nr_guest_instr - n : 0);
+  int id = (shared == NULL ? -1 : find_checkpoint(goal));
+  if (id == -1) {
+    printf("No checkpoint before the point, use `checkpoint N` to take them.\n");
+    return;
+  }
+  reverse_to(id, goal, REV_STEP);
+}
+
+void reverse_continue() {
+  int id = (shared == NULL || g_nr_guest_instr == 0 ? -1 : find_checkpoint(g_nr_guest_instr - 1));
+  if (id == -1) {
+    printf("No checkpoint before the point, use `checkpoint N` to take them.\n");
+    return;
+  }
+  reverse_to(id, g_nr_guest_instr, REV_CONTINUE);
+}
+
+// run to the point after `nr_instr` instructions without stopping at
+// breakpoints or watchpoints, return whether they are hit before it,
+// and the last point they are hit at in `*last`
+static bool run_to(uint64_t nr_instr, uint64_t *last) {
+  extern int g_nr_bp;
+  bool hit = (g_nr_bp > 0 && check_bp(cpu.pc) && g_nr_guest_instr < nr_instr);
+  *last = g_nr_guest_instr;
+  while (g_nr_guest_instr < nr_instr && nemu_state.state != NEMU_END &&
+      nemu_state.state != NEMU_ABORT) {
+    cpu_exec(nr_instr - g_nr_guest_instr);
+    if (g_nr_guest_instr < nr_instr) {
+      hit = true;
+      *last = g_nr_guest_instr;
+    }
+  }
+  return hit;
+}
+
+/* Called by sdb before reading a command. In the process restarted for
+ * reverse execution, re-execute the guest to the goal. For reverse
+ * continue, the last point hit by breakpoints or watchpoints before the
+ * goal is searched. If there is no such point after the checkpoint,
+ * the search goes on from the previous checkpoint.
+ * No checkpoint is taken automatically while re-executing, since it
+ * would be parked in the middle of it. */
+void reverse_finish() {
+  if (shared == NULL || shared->rev_mode == REV_NONE) return;
+  int mode = shared->rev_mode;
+  uint64_t goal = shared->rev_goal;
+  uint64_t start = g_nr_guest_instr;
+  shared->rev_mode = REV_NONE;
+
+  // the output of the guest and the traces have been printed before
+  fflush(stdout);
+  int stdout_fd = dup(STDOUT_FILENO);
+  int null_fd = open("/dev/null", O_WRONLY);
+  dup2(null_fd, STDOUT_FILENO);
+  close(null_fd);
+  uint64_t ckpt_instr = g_ckpt_instr;
+  g_ckpt_instr = UINT64_MAX;
+  uint64_t last;
+  bool hit = run_to(goal, &last);
+  g_ckpt_instr = ckpt_instr;
+  fflush(stdout);
+  dup2(stdout_fd, STDOUT_FILENO);
+  close(stdout_fd);
+
+  if (mode == REV_CONTINUE) {
+    int id = find_checkpoint(last);
+    if (hit) reverse_to(id, last, REV_STEP);
+    id = (start == 0 ? -1 : find_checkpoint(start - 1));
+    if (id != -1) reverse_to(id, start, REV_CONTINUE);
+    printf("Reach the oldest checkpoint.\n");
+    // stop at the point of the checkpoint
+    reverse_to(find_checkpoint(start), start, REV_STEP);
+  }
+  printf("Go back to pc = " FMT_WORD " after %" PRIu64 " instructions.\n", cpu.pc, g_nr_guest_instr);
+}
+
+void display_checkpoint() {
+  int i, n = 0;
+  for (i = 0; i < NR_CKPT; i ++) {
+    Checkpoint *c = (shared == NULL ? NULL : &shared->ckpt[i]);
+    if (c == NULL || c->pid == 0) continue;
+    if (n ++ == 0) printf("%-4s%-12s%-14s%s\n", "ID", "PC", "INSTRUCTIONS", "TYPE");
+    printf("%-4d" FMT_WORD "  %-14" PRIu64 "%s\n", i, c->pc, c->nr_instr, c->is_auto ? "auto" : "manual");
+  }
+  if (n == 0) printf("There is no checkpoint.\n");
+  if (ckpt_interval != 0) {
+    printf("A checkpoint is taken every %" PRIu64 " instructions.\n", ckpt_interval);
+  }
+}
+
+// called by the active process before exiting
+void exit_checkpoint() {
+  if (shared == NULL) return;
+  kill_checkpoints();
+  if (getpid() == shared->root) return;
+  fflush(stdout);
+  shared->exit_status = is_exit_status_bad();
+  shared->is_exit = true;
+  exit(shared->exit_status);
+}
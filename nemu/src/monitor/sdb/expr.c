@@ -1,257 +1,442 @@
 #include <isa.h>
 #include <memory/vaddr.h>
-
-/* We use the POSIX regex functions to process regular expressions.
- * Type 'man regex' for more information about POSIX regex functions.
+#include <ctype.h>
+#include "sdb.h"
+
+/* The expression is read by a hand-written lexer, which scans the string
+ * once and hands the tokens to the parser one by one, so there is no limit
+ * on the number of tokens. The parser climbs the precedence of the binary
+ * operators, and supports the operators of C except the ones with side
+ * effects (assignments, increments) and casts:
+ *   ?:  ||  &&  |  ^  &  == !=  < <= > >=  << >>  + -  * / %
+ *   unary + - ! ~ and * (read 4 bytes of memory)
+ * The operands are numbers (decimal, octal or hexadecimal as in C),
+ * registers like `$a0` and `$pc`, and function symbols loaded by --elf,
+ * which stand for their addresses. All values are unsigned words.
  */
-#include <regex.h>
 
 enum {
-  TK_NOTYPE = 256, 
-  TK_EQ,
-  TK_DEC,
-  TK_HEX,
-  TK_DEREF,
+  TK_END = 256,
+  TK_NUM,
   TK_REG,
+  TK_SYM,
+  TK_EQ, TK_NE, TK_LE, TK_GE, TK_SHL, TK_SHR, TK_LAND, TK_LOR,
+};
+
+typedef struct {
+  int type;
+  int pos;   // the position in the string, to report errors
+  int len;
+  word_t val;
+} Token;
+
+static const char *str = NULL;
+static int pos = 0;
+static Token tk = {};
 
-  /* TODO: Add more token types */
+static void syntax_error(int at, const char *msg) {
+  printf("%s at position %d\n%s\n%*s^\n", msg, at, str, at, "");
+}
+
+static inline bool is_ident(char c) {
+  return isalnum((unsigned char)c) || c == '_';
+}
+
+// read the next token into `tk`, return false if there is no legal one
+static bool next() {
+  while (isspace((unsigned char)str[pos])) pos ++;
+  const char *p = str + pos;
+  tk.pos = pos;
+  tk.len = 1;
+  tk.val = 0;
+
+  if (*p == '\0') {
+    tk.type = TK_END;
+    tk.len = 0;
+    return true;
+  }
 
+  if (isdigit((unsigned char)*p)) {
+    char *end;
+    tk.type = TK_NUM;
+    tk.val = strtoull(p, &end, 0);
+    while (*end == 'u' || *end == 'U' || *end == 'l' || *end == 'L') end ++;
+    if (is_ident(*end)) {
+      syntax_error(end - str, "Bad number");
+      return false;
+    }
+    tk.len = end - p;
+  } else if (*p == '$' || isalpha((unsigned char)*p) || *p == '_') {
+    tk.type = (*p == '$' ? TK_REG : TK_SYM);
+    for (tk.len = 1; is_ident(p[tk.len]); tk.len ++);
+    if (tk.len == 1 && tk.type == TK_REG) {
+      syntax_error(pos, "Missing the name of the register");
+      return false;
+    }
+  } else {
+    // the operators of two characters
+    static const struct { char s[3]; int type; } ops[] = {
+      {"==", TK_EQ}, {"!=", TK_NE}, {"<=", TK_LE}, {">=", TK_GE},
+      {"<<", TK_SHL}, {">>", TK_SHR}, {"&&", TK_LAND}, {"||", TK_LOR},
+    };
+    int i;
+    for (i = 0; i < ARRLEN(ops); i ++) {
+      if (p[0] == ops[i].s[0] && p[1] == ops[i].s[1]) break;
+    }
+    if (i < ARRLEN(ops)) {
+      tk.type = ops[i].type;
+      tk.len = 2;
+    } else if (strchr("+-*/%<>&|^!~?:()", *p) != NULL) {
+      tk.type = *p;
+    } else {
+      syntax_error(pos, "Unknown character");
+      return false;
+    }
+  }
+  pos += tk.len;
+  return true;
+}
+
+/* The expression is compiled into a sequence of postfix code, which is
+ * evaluated with a stack. Numbers, symbols and constant sub-expressions
+ * are folded, and registers are looked up at compile time, so that the
+ * code can be kept and evaluated quickly after every instruction by
+ * watchpoints and the triggers of tracing. `&&`, `||` and `?:` jump over
+ * the operand which is not evaluated, as in C.
+ */
+enum {
+  OP_IMM, OP_REG,
+  // unary
+  OP_NEG, OP_NOT, OP_LNOT, OP_BOOL, OP_DEREF,
+  // binary
+  OP_ADD, OP_SUB, OP_MUL, OP_DIV, OP_MOD, OP_SHL, OP_SHR,
+  OP_LT, OP_LE, OP_GT, OP_GE, OP_EQ, OP_NE, OP_AND, OP_XOR, OP_OR,
+  // jumps
+  OP_LAND, OP_LOR, OP_JZ, OP_JMP,
 };
 
-static struct rule {
-  const char *regex;
-  int token_type;
-} rules[] = {
-
-  /* TODO: Add more rules.
-   * Pay attention to the precedence level of different rules.
-   */
-
-  {"0x[[:digit:]a-fA-F]+", TK_HEX}, // hexadecimal number
-  {"[[:digit:]]+", TK_DEC},         // decimal number
-  {"\\$[^ ]*", TK_REG},             // register
-  {" +", TK_NOTYPE},                // spaces
-  {"\\(", '('},                     // left parenthese
-  {"\\)", ')'},                     // right parenthese
-  {"\\+", '+'},                     // plus
-  {"-", '-'},                       // minus
-  {"\\*", '*'},                     // multiple or dereference
-  {"/", '/'},                       // divide
-  {"==", TK_EQ},                    // equal
+typedef struct {
+  int op;
+  union {
+    word_t imm;
+    const word_t *reg;
+    int target; // the index of the code to jump to
+  };
+} Code;
+
+struct Expr {
+  int nr_code;
+  int depth; // the maximum depth of the stack
+  Code code[];
 };
 
-#define NR_REGEX ARRLEN(rules)
+static Code *code_buf = NULL;
+static int nr_code = 0, code_size = 0;
+// the depth of the stack after the code emitted so far
+static int depth = 0, max_depth = 0;
+// the code before it may be jumped over, so it can not be folded
+static int barrier = 0;
+
+static void emit(int op, word_t imm) {
+  if (nr_code == code_size) {
+    code_size = (code_size == 0 ? 64 : code_size * 2);
+    code_buf = realloc(code_buf, sizeof(Code) * code_size);
+    assert(code_buf);
+  }
+  code_buf[nr_code].op = op;
+  code_buf[nr_code].imm = imm;
+  nr_code ++;
+}
 
-static regex_t re[NR_REGEX] = {};
+static void push(int op, word_t imm) {
+  emit(op, imm);
+  if (++ depth > max_depth) max_depth = depth;
+}
 
-/* Rules are used for many times.
- * Therefore we compile them only once before any usage.
- */
-void init_regex() {
-  int i;
-  char error_msg[128];
-  int ret;
-
-  for (i = 0; i < NR_REGEX; i ++) {
-    ret = regcomp(&re[i], rules[i].regex, REG_EXTENDED);
-    if (ret != 0) {
-      regerror(ret, &re[i], error_msg, 128);
-      panic("regex compilation failed: %s\n%s", error_msg, rules[i].regex);
+static void push_reg(const word_t *reg) {
+  push(OP_REG, 0);
+  code_buf[nr_code - 1].reg = reg;
+}
+
+static inline bool is_imm(int i) {
+  return i >= barrier && code_buf[i].op == OP_IMM;
+}
+
+// the jump at `j` goes to the code emitted next
+static void patch(int j) {
+  code_buf[j].target = nr_code;
+  barrier = nr_code;
+}
+
+static void calc_unary(int op, word_t *v) {
+  switch (op) {
+    case OP_NEG: *v = -*v; break;
+    case OP_NOT: *v = ~*v; break;
+    case OP_LNOT: *v = !*v; break;
+    case OP_BOOL: *v = !!*v; break;
+    case OP_DEREF: *v = vaddr_peek(*v, 4); break;
+    default: assert(0);
+  }
+}
+
+// return false for division by zero
+static bool calc_binary(int op, word_t *a, word_t b) {
+  switch (op) {
+    case OP_ADD: *a += b; break;
+    case OP_SUB: *a -= b; break;
+    case OP_MUL: *a *= b; break;
+    case OP_DIV: if (b == 0) return false; *a /= b; break;
+    case OP_MOD: if (b == 0) return false; *a %= b; break;
+    case OP_SHL: *a = (b >= sizeof(word_t) * 8 ? 0 : *a << b); break;
+    case OP_SHR: *a = (b >= sizeof(word_t) * 8 ? 0 : *a >> b); break;
+    case OP_LT: *a = (*a < b); break;
+    case OP_LE: *a = (*a <= b); break;
+    case OP_GT: *a = (*a > b); break;
+    case OP_GE: *a = (*a >= b); break;
+    case OP_EQ: *a = (*a == b); break;
+    case OP_NE: *a = (*a != b); break;
+    case OP_AND: *a &= b; break;
+    case OP_XOR: *a ^= b; break;
+    case OP_OR: *a |= b; break;
+    default: assert(0);
+  }
+  return true;
+}
+
+static void emit_unary(int op) {
+  // the memory may change, so dereferences are never folded
+  if (op != OP_DEREF && is_imm(nr_code - 1)) {
+    calc_unary(op, &code_buf[nr_code - 1].imm);
+    return;
+  }
+  emit(op, 0);
+}
+
+static void emit_binary(int op) {
+  if (is_imm(nr_code - 2) && is_imm(nr_code - 1)) {
+    word_t a = code_buf[nr_code - 2].imm;
+    // leave the division by zero to expr_eval(), which fails
+    if (calc_binary(op, &a, code_buf[nr_code - 1].imm)) {
+      code_buf[nr_code - 2].imm = a;
+      nr_code --;
+      depth --;
+      return;
     }
   }
+  emit(op, 0);
+  depth --;
 }
 
-typedef struct token {
-  int type;
-  char str[32];
-} Token;
+/* The precedence of the binary operators, and the code of them.
+ * A higher precedence binds tighter, and 0 means not a binary operator.
+ */
+static int binary_prec(int type, int *op) {
+  switch (type) {
+    case '?': return 1;
+    case TK_LOR: *op = OP_LOR; return 2;
+    case TK_LAND: *op = OP_LAND; return 3;
+    case '|': *op = OP_OR; return 4;
+    case '^': *op = OP_XOR; return 5;
+    case '&': *op = OP_AND; return 6;
+    case TK_EQ: *op = OP_EQ; return 7;
+    case TK_NE: *op = OP_NE; return 7;
+    case '<': *op = OP_LT; return 8;
+    case TK_LE: *op = OP_LE; return 8;
+    case '>': *op = OP_GT; return 8;
+    case TK_GE: *op = OP_GE; return 8;
+    case TK_SHL: *op = OP_SHL; return 9;
+    case TK_SHR: *op = OP_SHR; return 9;
+    case '+': *op = OP_ADD; return 10;
+    case '-': *op = OP_SUB; return 10;
+    case '*': *op = OP_MUL; return 11;
+    case '/': *op = OP_DIV; return 11;
+    case '%': *op = OP_MOD; return 11;
+    default: return 0;
+  }
+}
 
-static Token tokens[32] __attribute__((used)) = {};
-static int nr_token __attribute__((used))  = 0;
-
-static bool make_token(char *e) {
-  int position = 0;
-  int i;
-  regmatch_t pmatch;
-
-  nr_token = 0;
-
-  while (e[position] != '\0') {
-    /* Try all rules one by one. */
-    for (i = 0; i < NR_REGEX; i ++) {
-      if (regexec(&re[i], e + position, 1, &pmatch, 0) == 0 && pmatch.rm_so == 0) {
-        char *substr_start = e + position;
-        int substr_len = pmatch.rm_eo;
-
-        Log("match rules[%d] = \"%s\" at position %d with len %d: %.*s",
-            i, rules[i].regex, position, substr_len, substr_len, substr_start);
-
-        position += substr_len;
-
-        /* TODO: Now a new token is recognized with rules[i]. Add codes
-         * to record the token in the array `tokens'. For certain types
-         * of tokens, some extra actions should be performed.
-         */
-
-        switch (rules[i].token_type) {
-        case TK_DEC: case TK_HEX: case TK_REG:
-          if (substr_len > 31) {
-            // token is too long.
-            return false;
-            break;
-          }
-          memcpy(tokens[nr_token].str, substr_start, substr_len);
-          tokens[nr_token].str[substr_len] = '\0';
-        case '+': case '-': case '*': case '/':
-        case '(': case ')': case TK_EQ:
-          tokens[nr_token].type = rules[i].token_type;
-          nr_token++;
-          break;
-        case TK_NOTYPE:
-          break;
-        default: TODO();
-        }
+static bool parse_expr(int min_prec);
+
+static bool parse_unary() {
+  Token t = tk;
+  int op;
+  switch (t.type) {
+    case '+': case '-': case '!': case '~': case '*':
+      if (!next() || !parse_unary()) return false;
+      op = (t.type == '-' ? OP_NEG : t.type == '!' ? OP_LNOT :
+          t.type == '~' ? OP_NOT : t.type == '*' ? OP_DEREF : -1);
+      if (op >= 0) emit_unary(op);
+      return true;
+
+    case '(':
+      if (!next() || !parse_expr(1)) return false;
+      if (tk.type != ')') {
+        syntax_error(tk.pos, "Missing ')'");
+        return false;
+      }
+      return next();
+
+    case TK_NUM:
+      push(OP_IMM, t.val);
+      return next();
+
+    case TK_REG: {
+      char name[t.len + 1];
+      memcpy(name, str + t.pos, t.len);
+      name[t.len] = '\0';
+      const word_t *reg = isa_reg_str2ptr(name);
+      if (reg == NULL) {
+        syntax_error(t.pos, "Unknown register");
+        return false;
+      }
+      push_reg(reg);
+      return next();
+    }
 
-        break;
+    case TK_SYM: {
+      char name[t.len + 1];
+      memcpy(name, str + t.pos, t.len);
+      name[t.len] = '\0';
+      int idx = symbol_lookup(name);
+      if (idx < 0) {
+        syntax_error(t.pos, "Unknown symbol");
+        return false;
       }
+      push(OP_IMM, symbol_get(idx)->start);
+      return next();
     }
 
-    if (i == NR_REGEX) {
-      printf("no match at position %d\n%s\n%*.s^\n", position, e, position, "");
+    default:
+      syntax_error(t.pos, "Missing an operand");
       return false;
-    }
   }
+}
 
-  // scan the tokens to find dereference operators
-  for (int i = 0; i < nr_token; i++) {
-    if (tokens[i].type == '*' && (i == 0 || (tokens[i - 1].type != TK_DEC && tokens[i - 1].type != TK_HEX && tokens[i - 1].type != TK_REG))) {
-      tokens[i].type = TK_DEREF;
+// parse the binary operators of at least `min_prec` by precedence climbing
+static bool parse_expr(int min_prec) {
+  if (!parse_unary()) return false;
+
+  int op = 0, prec;
+  while ((prec = binary_prec(tk.type, &op)) >= min_prec) {
+    int type = tk.type;
+    if (!next()) return false;
+
+    if (type == '?') {
+      // cond ? a : b, which is right associative
+      int jz = nr_code;
+      emit(OP_JZ, 0);
+      depth --;
+      if (!parse_expr(1)) return false;
+      if (tk.type != ':') {
+        syntax_error(tk.pos, "Missing ':'");
+        return false;
+      }
+      if (!next()) return false;
+      int jmp = nr_code;
+      emit(OP_JMP, 0);
+      depth --;
+      patch(jz);
+      if (!parse_expr(prec)) return false;
+      patch(jmp);
+    } else if (type == TK_LAND || type == TK_LOR) {
+      // keep the result of the left operand if it decides the value,
+      // otherwise drop it, and the value is the right operand as a bool
+      int j = nr_code;
+      emit(op, 0);
+      depth --;
+      if (!parse_expr(prec + 1)) return false;
+      emit(OP_BOOL, 0);
+      patch(j);
+    } else {
+      // all the others are left associative
+      if (!parse_expr(prec + 1)) return false;
+      emit_binary(op);
     }
   }
-
   return true;
 }
 
-// check if the sub-expression is wrapped by a pair of parentheses
-static bool check_parentheses(int begin, int end)
-{
-  if (tokens[begin].type != '(' || tokens[end].type != ')') {
-    return false;
+Expr* expr_compile(char *e) {
+  str = e;
+  pos = 0;
+  nr_code = 0;
+  depth = max_depth = 0;
+  barrier = 0;
+  if (!next() || !parse_expr(1)) return NULL;
+  if (tk.type != TK_END) {
+    syntax_error(tk.pos, "Unexpected token");
+    return NULL;
   }
 
-  // check the remaining parentheses, use an integer 'match'
-  // to simulate a stack
-  int match = 0;
-  for (begin = begin + 1; begin < end; begin++) {
-    if (match < 0) {
-      return false;
-    }
-    if (tokens[begin].type == '(') {
-      match++;
-    } else if (tokens[begin].type == ')') {
-      match--;
-    }
-  }
-  if (match == 0) {
-    return true;
-  } else {
-    return false;
-  }
+  Expr *ret = malloc(sizeof(Expr) + sizeof(Code) * nr_code);
+  assert(ret);
+  ret->nr_code = nr_code;
+  ret->depth = max_depth;
+  memcpy(ret->code, code_buf, sizeof(Code) * nr_code);
+  return ret;
 }
 
-// calculate the value of tokens begin with 'begin' and end with 'end'
-// priority: deref '>' * '=' / '>' + '=' - '>' ==
-static word_t eval(int begin, int end, bool *success)
-{
-  if (*success == false) {
-    return 0;
-  }
-  if (begin > end) {
-    *success = false;
-    return 0;
-  } else if (begin == end) {
-    word_t ret;
-    switch (tokens[begin].type) {
-    case TK_DEC:
-      ret = atoi(tokens[begin].str);
-      return ret;
-      break;
-    case TK_HEX:
-      sscanf(tokens[begin].str, "%x", &ret);
-      return ret;
-      break;
-    case TK_REG:
-      ret = isa_reg_str2val(tokens[begin].str, success);
-      return ret;
-      break;
-    default:
-      *success = false;
-      return 0;
-    }
-  } else if (check_parentheses(begin, end)) {
-    return eval(begin + 1, end - 1, success);
-  } else {
-    // find the main operator
-    int op = 0, type = 0, match = 0;
-    for (int i = begin; i <= end; i++) {
-      if (match < 0) {
-        *success = false;
-        return 0;
-      }
-      switch (tokens[i].type) {
-      case '(':
-        match++;
+word_t expr_eval(const Expr *e, bool *success) {
+  word_t stack[e->depth];
+  int sp = 0;
+  const Code *c = e->code, *end = e->code + e->nr_code;
+
+  // the code generated by parse_expr() always leaves one value
+  for (; c < end; c ++) {
+    switch (c->op) {
+      case OP_IMM: stack[sp ++] = c->imm; break;
+      case OP_REG: stack[sp ++] = *c->reg; break;
+      case OP_LAND:
+        if (stack[sp - 1] == 0) c = e->code + c->target - 1;
+        else sp --;
         break;
-      case ')':
-        match--;
+      case OP_LOR:
+        if (stack[sp - 1] != 0) {
+          stack[sp - 1] = 1;
+          c = e->code + c->target - 1;
+        } else sp --;
         break;
-      case '+': case '-': case '*': case '/': case TK_DEREF: case TK_EQ:
-        if (match == 0 && (((type == 0 || type == '*' || type == '/' || type == TK_DEREF || type == '+' || type == '-') && (tokens[i].type == TK_EQ                       )) ||
-                           ((type == 0 || type == '*' || type == '/' || type == TK_DEREF)                               && (tokens[i].type == '+' || tokens[i].type == '-')) || 
-                           ((type == 0 || type == TK_DEREF)                                                             && (tokens[i].type == '*' || tokens[i].type == '/')) ||
-                           ((type == 0)                                                                                 && (tokens[i].type == TK_DEREF                    )))) {
-          type = tokens[i].type;
-          op = i;
-        }
+      case OP_JZ:
+        if (stack[-- sp] == 0) c = e->code + c->target - 1;
         break;
+      case OP_JMP: c = e->code + c->target - 1; break;
       default:
+        if (c->op < OP_ADD) {
+          calc_unary(c->op, &stack[sp - 1]);
+          break;
+        }
+        sp --;
+        if (!calc_binary(c->op, &stack[sp - 1], stack[sp])) {
+          *success = false;
+          return 0;
+        }
         break;
-      }
-    }
-    if (type == 0) {
-      *success = false;
-      return 0;
     }
+  }
+  *success = true;
+  return stack[0];
+}
 
-    int rval, lval;
-    if (type != TK_DEREF) {
-      lval = eval(begin, op - 1, success);
-    } 
-    rval = eval(op + 1, end, success);
-
-    switch (type) {
-      case '+': return rval + lval;
-      case '-': return rval - lval;
-      case '*': return rval * lval;
-      case '/': return rval / lval;
-      case TK_DEREF: return vaddr_read(rval, 4);
-      case TK_EQ: return rval == lval;
-      default: assert(0);
-    }
+// check whether the expression is `*ADDR` with a constant ADDR,
+// which can be watched by the memory
+bool expr_is_deref_const(const Expr *e, word_t *addr) {
+  if (e->nr_code == 2 && e->code[0].op == OP_IMM && e->code[1].op == OP_DEREF) {
+    *addr = e->code[0].imm;
+    return true;
   }
+  return false;
 }
 
 word_t expr(char *e, bool *success) {
-  if (!make_token(e)) {
+  Expr *code = expr_compile(e);
+  if (code == NULL) {
     *success = false;
     return 0;
-  } else {
-    *success = true;
   }
 
-  /* TODO: Insert codes to evaluate the expression. */
-
-  // Initialize '*success' to true, if there is something wrong
-  // in eval, it will be set to false.
-  return eval(0, nr_token - 1, success);
+  word_t ret = expr_eval(code, success);
+  // the compiled code only fails by division by zero
+  if (!*success) printf("Division by zero\n");
+  free(code);
+  return ret;
 }
@@ -0,0 +1,369 @@
+#include <isa.h>
+#include <cpu/cpu.h>
+#include <memory/paddr.h>
+#include <difftest-def.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+#include "sdb.h"
+
+/* A GDB remote serial protocol stub. It serves one connection from gdb
+ * with the guest running in cpu_exec() between stops. The registers are
+ * exchanged in the layout of difftest, which matches the order of gdb for
+ * the GPRs and pc. Breakpoints and write watchpoints are set with the ones
+ * of sdb.
+ */
+
+#define PACKET_SIZE 4096
+// the number of instructions to run before polling the interrupt from gdb
+#define RUN_CHUNK (1 << 16)
+#define NR_REG_SLOT (DIFFTEST_REG_SIZE / sizeof(word_t))
+
+#define GDB_ARCH MUXDEF(CONFIG_ISA_x86, "i386", MUXDEF(CONFIG_ISA_mips32, "mips", \
+  MUXDEF(CONFIG_ISA_riscv32, "riscv:rv32", MUXDEF(CONFIG_ISA_riscv64, "riscv:rv64", "none"))))
+
+extern uint64_t g_nr_guest_instr;
+extern int g_nr_bp;
+bool check_bp(vaddr_t pc);
+int wp_last_hit(paddr_t *addr);
+
+static int fd = -1;
+static bool is_noack = false;
+static char inbuf[PACKET_SIZE];
+static int in_len = 0, in_pos = 0;
+
+static int gdb_getc() {
+  if (in_pos == in_len) {
+    in_len = read(fd, inbuf, sizeof(inbuf));
+    in_pos = 0;
+    if (in_len <= 0) {
+      return -1;
+    }
+  }
+  return (uint8_t)inbuf[in_pos ++];
+}
+
+static void gdb_write(const char *buf, int len) {
+  while (len > 0) {
+    int ret = write(fd, buf, len);
+    if (ret <= 0) {
+      return;
+    }
+    buf += ret;
+    len -= ret;
+  }
+}
+
+static int hex2int(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+static void mem2hex(const uint8_t *mem, char *buf, int len) {
+  static const char hex[] = "0123456789abcdef";
+  for (int i = 0; i < len; i ++) {
+    *buf ++ = hex[mem[i] >> 4];
+    *buf ++ = hex[mem[i] & 0xf];
+  }
+  *buf = '\0';
+}
+
+// check the whole data before writing, so a bad packet changes nothing
+static bool hex2mem(const char *buf, uint8_t *mem, int len) {
+  for (int i = 0; i < 2 * len; i ++) {
+    if (hex2int(buf[i]) < 0) {
+      return false;
+    }
+  }
+  for (int i = 0; i < len; i ++) {
+    mem[i] = (hex2int(buf[2 * i]) << 4) | hex2int(buf[2 * i + 1]);
+  }
+  return true;
+}
+
+static void send_packet(const char *data) {
+  char buf[PACKET_SIZE + 8];
+  uint8_t sum = 0;
+  int len = 0;
+  buf[len ++] = '$';
+  for (; *data != '\0'; data ++) {
+    sum += *data;
+    buf[len ++] = *data;
+  }
+  len += sprintf(buf + len, "#%02x", sum);
+
+  do {
+    gdb_write(buf, len);
+  } while (!is_noack && gdb_getc() == '-');
+}
+
+// return NULL if the connection is closed
+static char* recv_packet() {
+  static char buf[PACKET_SIZE + 1];
+  int c;
+  while (true) {
+    // skip everything before the start of a packet, including the acks
+    while ((c = gdb_getc()) != '$') {
+      if (c < 0) {
+        return NULL;
+      }
+    }
+
+    uint8_t sum = 0;
+    int len = 0;
+    while ((c = gdb_getc()) != '#') {
+      if (c < 0) {
+        return NULL;
+      }
+      sum += c;
+      if (len < PACKET_SIZE) {
+        buf[len ++] = c;
+      }
+    }
+    buf[len] = '\0';
+    int hi = hex2int(gdb_getc()), lo = hex2int(gdb_getc());
+    bool ok = (((hi << 4) | lo) == sum);
+    if (is_noack) {
+      return buf;
+    }
+    gdb_write(ok ? "+" : "-", 1);
+    if (ok) {
+      return buf;
+    }
+  }
+}
+
+// only consume the interrupt, the other bytes are left to recv_packet()
+static bool poll_interrupt() {
+  if (in_pos < in_len) {
+    if (inbuf[in_pos] != 0x03) {
+      return false;
+    }
+    in_pos ++;
+    return true;
+  }
+  char c;
+  if (recv(fd, &c, 1, MSG_DONTWAIT | MSG_PEEK) != 1 || c != 0x03) {
+    return false;
+  }
+  recv(fd, &c, 1, 0);
+  return true;
+}
+
+// run the guest and return the stop reply
+static void gdb_run(bool is_step, char *reply) {
+  if (is_step) {
+    cpu_exec_silent(1);
+  } else {
+    bool is_first = true;
+    while (true) {
+      // cpu_exec() does not check the breakpoint at its first instruction
+      if (!is_first && g_nr_bp > 0 && check_bp(cpu.pc)) {
+        break;
+      }
+      is_first = false;
+      uint64_t start = g_nr_guest_instr;
+      cpu_exec_silent(RUN_CHUNK);
+      if (nemu_state.state != NEMU_STOP || g_nr_guest_instr - start < RUN_CHUNK) {
+        break;
+      }
+      if (poll_interrupt()) {
+        strcpy(reply, "S02");
+        return;
+      }
+    }
+  }
+
+  paddr_t addr;
+  switch (nemu_state.state) {
+    case NEMU_END: sprintf(reply, "W%02x", nemu_state.halt_ret & 0xff); return;
+    case NEMU_ABORT: case NEMU_QUIT: strcpy(reply, "X06"); return;
+  }
+  if (wp_last_hit(&addr) >= 0) {
+    sprintf(reply, "T05watch:%lx;", (unsigned long)addr);
+  } else {
+    strcpy(reply, "S05");
+  }
+}
+
+static void read_mem(char *args, char *reply) {
+  unsigned long addr, len;
+  if (sscanf(args, "%lx,%lx", &addr, &len) != 2 || len * 2 > PACKET_SIZE ||
+      !in_pmem(addr) || !in_pmem(addr + len - 1)) {
+    strcpy(reply, "E14");
+    return;
+  }
+  mem2hex(guest_to_host(addr), reply, len);
+}
+
+static void write_mem(char *args, char *reply) {
+  unsigned long addr, len;
+  char *data = strchr(args, ':');
+  if (data == NULL || sscanf(args, "%lx,%lx", &addr, &len) != 2) {
+    strcpy(reply, "E01");
+    return;
+  }
+  if (len == 0) {
+    strcpy(reply, "OK");
+    return;
+  }
+  if (!in_pmem(addr) || !in_pmem(addr + len - 1) ||
+      !hex2mem(data + 1, guest_to_host(addr), len)) {
+    strcpy(reply, "E14");
+    return;
+  }
+  strcpy(reply, "OK");
+}
+
+static void read_reg(char *args, char *reply) {
+  unsigned long idx = strtoul(args, NULL, 16);
+  if (idx < NR_REG_SLOT) {
+    mem2hex((uint8_t *)&cpu + idx * sizeof(word_t), reply, sizeof(word_t));
+  } else {
+    // unavailable
+    memset(reply, 'x', sizeof(word_t) * 2);
+    reply[sizeof(word_t) * 2] = '\0';
+  }
+}
+
+static void write_reg(char *args, char *reply) {
+  char *val = strchr(args, '=');
+  unsigned long idx = strtoul(args, NULL, 16);
+  if (val == NULL || idx >= NR_REG_SLOT ||
+      !hex2mem(val + 1, (uint8_t *)&cpu + idx * sizeof(word_t), sizeof(word_t))) {
+    strcpy(reply, "E01");
+    return;
+  }
+  strcpy(reply, "OK");
+}
+
+// Z/z packets: type,addr,kind
+static void set_point(char *args, bool is_insert, char *reply) {
+  int type;
+  unsigned long addr, kind;
+  if (sscanf(args, "%d,%lx,%lx", &type, &addr, &kind) != 3) {
+    strcpy(reply, "E01");
+    return;
+  }
+  int ret;
+  switch (type) {
+    case 0: case 1: // software and hardware breakpoints
+      ret = (is_insert ? add_bp(addr) : del_bp(addr));
+      // setting an existing breakpoint is fine
+      strcpy(reply, (ret == 0 || (is_insert && ret == 1)) ? "OK" : "E01");
+      return;
+    case 2: // write watchpoint
+      if (kind != 1 && kind != 2 && kind != 4 && !(MUXDEF(CONFIG_ISA64, true, false) && kind == 8)) {
+        break;
+      }
+      ret = (is_insert ? (add_wp_mem(addr, kind) < 0) : del_wp_mem(addr, kind));
+      strcpy(reply, ret == 0 ? "OK" : "E01");
+      return;
+  }
+  // read and access watchpoints are not supported
+  reply[0] = '\0';
+}
+
+static bool handle_query(char *pkt, char *reply) {
+  if (strncmp(pkt, "qSupported", 10) == 0) {
+    sprintf(reply, "PacketSize=%x;qXfer:features:read+;QStartNoAckMode+", PACKET_SIZE);
+  } else if (strncmp(pkt, "qXfer:features:read:target.xml:", 31) == 0) {
+    static const char xml[] = "<?xml version=\"1.0\"?><!DOCTYPE target SYSTEM \"gdb-target.dtd\">"
+      "<target><architecture>" GDB_ARCH "</architecture></target>";
+    unsigned long off, len;
+    sscanf(pkt + 31, "%lx,%lx", &off, &len);
+    if (off >= sizeof(xml) - 1) {
+      strcpy(reply, "l");
+    } else {
+      snprintf(reply, PACKET_SIZE, "%c%.*s", (off + len >= sizeof(xml) - 1 ? 'l' : 'm'),
+          (int)len, xml + off);
+    }
+  } else if (strcmp(pkt, "QStartNoAckMode") == 0) {
+    strcpy(reply, "OK");
+    send_packet(reply);
+    is_noack = true;
+    return false;
+  } else if (strcmp(pkt, "qAttached") == 0) {
+    strcpy(reply, "1");
+  } else if (strcmp(pkt, "qC") == 0) {
+    strcpy(reply, "QC1");
+  } else if (strcmp(pkt, "qfThreadInfo") == 0) {
+    strcpy(reply, "m1");
+  } else if (strcmp(pkt, "qsThreadInfo") == 0) {
+    strcpy(reply, "l");
+  } else {
+    reply[0] = '\0';
+  }
+  return true;
+}
+
+static void handle_vpacket(char *pkt, char *reply) {
+  if (strcmp(pkt, "vCont?") == 0) {
+    strcpy(reply, "vCont;c;C;s;S");
+  } else if (strncmp(pkt, "vCont;", 6) == 0) {
+    // there is only one thread, so only the first action matters
+    char action = pkt[6];
+    gdb_run(action == 's' || action == 'S', reply);
+  } else {
+    reply[0] = '\0';
+  }
+}
+
+void gdb_mainloop(int port) {
+  int sock = socket(AF_INET, SOCK_STREAM, 0);
+  assert(sock >= 0);
+  int opt = 1;
+  setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+  struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(port),
+    .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+  Assert(bind(sock, (struct sockaddr *)&addr, sizeof(addr)) == 0, "Can not bind to port %d", port);
+  listen(sock, 1);
+
+  Log("Waiting for gdb to connect at port %d, run `target remote :%d` in gdb", port, port);
+  fd = accept(sock, NULL, NULL);
+  assert(fd >= 0);
+  close(sock);
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+  Log("gdb is connected");
+
+  static char reply[PACKET_SIZE + 1];
+  char *pkt;
+  while ((pkt = recv_packet()) != NULL) {
+    bool need_reply = true;
+    reply[0] = '\0';
+    switch (pkt[0]) {
+      case '?': strcpy(reply, "S05"); break;
+      case 'g': mem2hex((uint8_t *)&cpu, reply, DIFFTEST_REG_SIZE); break;
+      case 'G':
+        strcpy(reply, hex2mem(pkt + 1, (uint8_t *)&cpu, DIFFTEST_REG_SIZE) ? "OK" : "E01");
+        break;
+      case 'p': read_reg(pkt + 1, reply); break;
+      case 'P': write_reg(pkt + 1, reply); break;
+      case 'm': read_mem(pkt + 1, reply); break;
+      case 'M': write_mem(pkt + 1, reply); break;
+      case 'c': gdb_run(false, reply); break;
+      case 's': gdb_run(true, reply); break;
+      case 'Z': set_point(pkt + 1, true, reply); break;
+      case 'z': set_point(pkt + 1, false, reply); break;
+      case 'H': strcpy(reply, "OK"); break;
+      case 'T': strcpy(reply, "OK"); break;
+      case 'q': case 'Q': need_reply = handle_query(pkt, reply); break;
+      case 'v': handle_vpacket(pkt, reply); break;
+      case 'D': send_packet("OK"); // fall through
+      case 'k': nemu_state.state = NEMU_QUIT; need_reply = false; break;
+      default: break; // unsupported
+    }
+    if (need_reply) {
+      send_packet(reply);
+    }
+    if (nemu_state.state == NEMU_QUIT || reply[0] == 'W' || reply[0] == 'X') {
+      break;
+    }
+  }
+
+  close(fd);
+  Log("gdb is disconnected");
+}
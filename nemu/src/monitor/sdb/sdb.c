@@ -1,14 +1,17 @@
 #include <isa.h>
 #include <cpu/cpu.h>
 #include <memory/vaddr.h>
+#include <cpu/difftest.h>
 #include <readline/readline.h>
 #include <readline/history.h>
 #include "sdb.h"
 
 static int is_batch_mode = false;
+static int gdb_port = 0;
+static char *save_file = NULL;
 
-void init_regex();
 void init_wp_pool();
+void gdb_mainloop(int port);
 
 /* We use the `readline' library to provide more flexibility to read from stdin. */
 static char* rl_gets() {
@@ -66,7 +69,7 @@ static int cmd_info(char *args)
 {
   char *arg = strtok(args, " ");
   if (arg == NULL) {
-      printf("Please input [r] for registers or [w] for watchpoints.\n");
+      printf("Please input [r] for registers, [w] for watchpoints, [b] for breakpoints or [c] for checkpoints.\n");
       return 0;
   }
 
@@ -80,9 +83,17 @@ static int cmd_info(char *args)
   case 'w':
     display_wp();
     break;
+
+  case 'b':
+    display_bp();
+    break;
+
+  case 'c':
+    display_checkpoint();
+    break;
   
   default:
-    printf("Please input [r] for registers or [w] for watchpoints.\n");
+    printf("Please input [r] for registers, [w] for watchpoints, [b] for breakpoints or [c] for checkpoints.\n");
     break;
   }
   return 0;
@@ -111,7 +122,7 @@ static int cmd_x(char *args)
   while (N > 0) {
     printf("0x%08x: ", vaddr);
     for (int i = 4; i > 0 && N > 0; i--, N--, vaddr += 4) {
-      printf("%08x ", vaddr_read(vaddr, 4));
+      printf("%08x ", vaddr_peek(vaddr, 4));
     }
       putchar('\n');
   }
@@ -153,8 +164,51 @@ static int cmd_w(char *args)
   return 0;
 }
 
+static int cmd_b(char *args)
+{
+  bool success;
+  if (args == NULL) {
+    printf("Please input [EXPR] for the address of the breakpoint.\n");
+    return 0;
+  }
+  vaddr_t pc = expr(args, &success);
+  if (success == false) {
+    printf("Illegal expression, please retry.\n");
+    return 0;
+  }
+  switch (add_bp(pc)) {
+  case 1:
+    printf("There is already a breakpoint at " FMT_WORD ".\n", pc);
+    break;
+  case 2:
+    printf("There is no available breakpoint in the table.\n");
+    break;
+  case 0:
+    printf("Successfully set a breakpoint at " FMT_WORD ".\n", pc);
+    break;
+  default:
+    break;
+  }
+  return 0;
+}
+
+// watchpoints are deleted by their numbers, while
+// breakpoints are deleted by their addresses in hexadecimal
 static int cmd_d(char *args)
 {
+  if (args == NULL) {
+    printf("Please input [N] for a watchpoint or [ADDR] in hexadecimal for a breakpoint.\n");
+    return 0;
+  }
+  if (strncmp(args, "0x", 2) == 0) {
+    vaddr_t pc = strtoull(args, NULL, 16);
+    if (del_bp(pc) == 1) {
+      printf("No breakpoint at " FMT_WORD ".\n", pc);
+    } else {
+      printf("Successfully delete breakpoint at " FMT_WORD ".\n", pc);
+    }
+    return 0;
+  }
   int NO = atoi(args);
   if (del_wp(NO) == 1) {
     printf("No such watchpoint set.\n");
@@ -164,6 +218,161 @@ static int cmd_d(char *args)
   return 0;
 }
 
+static int cmd_save(char *args)
+{
+  if (args == NULL) {
+    printf("Please input the FILE to save the snapshot.\n");
+    return 0;
+  }
+  save_snapshot(args);
+  return 0;
+}
+
+static int cmd_load(char *args)
+{
+  if (args == NULL) {
+    printf("Please input the FILE to load the snapshot.\n");
+    return 0;
+  }
+  if (load_snapshot(args)) {
+    // REF should start from the same state
+    difftest_attach();
+  }
+  return 0;
+}
+
+// take a checkpoint now, and also every [N] instructions if N is given
+static int cmd_checkpoint(char *args)
+{
+  if (args != NULL) {
+    char *end;
+    long long n = strtoll(args, &end, 0);
+    if (*end != '\0' || n < 0) {
+      printf("Please input a non-negative integer.\n");
+      return 0;
+    }
+    set_checkpoint_interval(n);
+    if (n == 0) {
+      printf("Stop taking checkpoints automatically.\n");
+      return 0;
+    }
+  }
+  bool restarted;
+  int id = take_checkpoint(false, &restarted);
+  if (id >= 0 && !restarted) {
+    printf("Checkpoint %d at pc = " FMT_WORD ".\n", id, cpu.pc);
+  }
+  return 0;
+}
+
+static int cmd_restart(char *args)
+{
+  if (args == NULL) {
+    printf("Please input [N] for the checkpoint to restart.\n");
+    return 0;
+  }
+  if (restart_checkpoint(atoi(args)) == 1) {
+    printf("No such checkpoint.\n");
+  }
+  return 0;
+}
+
+static int cmd_rsi(char *args)
+{
+  long long n = 1;
+  if (args != NULL) {
+    n = atoll(args);
+    if (n <= 0) {
+      printf("Please input a positive integer.\n");
+      return 0;
+    }
+  }
+  reverse_step(n);
+  return 0;
+}
+
+static int cmd_rc(char *args)
+{
+  reverse_continue();
+  return 0;
+}
+
+#ifdef CONFIG_ITRACE_RING
+static int cmd_itrace(char *args)
+{
+  void itrace_dump(const char *file);
+  itrace_dump(args == NULL ? CONFIG_ITRACE_RING_FILE : args);
+  return 0;
+}
+#endif
+
+#ifdef CONFIG_TRACE
+static bool parse_addr(char *arg, vaddr_t *addr) {
+  bool success = false;
+  if (arg != NULL) *addr = expr(arg, &success);
+  if (!success) printf("Illegal expression, please retry.\n");
+  return success;
+}
+
+static int cmd_trace(char *args)
+{
+  char *arg = strtok(args, " ");
+  char *rest = strtok(NULL, "");
+  if (arg == NULL) {
+    trace_display();
+    return 0;
+  }
+  if (strcmp(arg, "on") == 0) trace_set_enable(true);
+  else if (strcmp(arg, "off") == 0) trace_set_enable(false);
+  else if (strcmp(arg, "clear") == 0) trace_clear();
+  else if (strcmp(arg, "instr") == 0) {
+    // an omitted END means no end
+    unsigned long long start = 0, end = UINT64_MAX;
+    if (rest != NULL && sscanf(rest, "%llu %llu", &start, &end) < 1) {
+      printf("Please input [START] and [END] in the number of instructions.\n");
+      return 0;
+    }
+    trace_set_window(start, end);
+  } else if (strcmp(arg, "pc") == 0) {
+    if (rest == NULL) trace_set_pc(0, 0);
+    else {
+      // the expressions may contain spaces, so HI follows a ','
+      char *hi_str = strchr(rest, ',');
+      if (hi_str != NULL) *hi_str ++ = '\0';
+      vaddr_t lo = 0, hi = 0;
+      if (!parse_addr(rest, &lo)) return 0;
+      // only the instruction at LO without HI
+      if (hi_str == NULL) hi = lo + 1;
+      else if (!parse_addr(hi_str, &hi)) return 0;
+      trace_set_pc(lo, hi);
+    }
+  } else if (strcmp(arg, "func") == 0) {
+#ifdef CONFIG_FTRACE
+    int idx = -1;
+    if (rest != NULL && (idx = symbol_lookup(rest)) < 0) {
+      printf("No such function, please load the symbols by --elf=FILE.\n");
+      return 0;
+    }
+    trace_set_func(idx);
+#else
+    // the calls and returns are only followed by ftrace
+    printf("Please enable CONFIG_FTRACE to trace by functions.\n");
+    return 0;
+#endif
+  } else if (strcmp(arg, "if") == 0) {
+    if (!trace_set_cond(rest)) {
+      printf("Illegal expression, please retry.\n");
+      return 0;
+    }
+  } else {
+    printf("Unknown subcommand '%s'.\n", arg);
+    return 0;
+  }
+  trace_display();
+  return 0;
+}
+#endif
+
 static int cmd_help(char *args);
 
 static struct {
@@ -175,11 +384,25 @@ static struct {
   { "c", "Continue the execution of the program", cmd_c },
   { "q", "Exit NEMU", cmd_q },
   { "si", "Run [N] instructions", cmd_si },
-  { "info", "Print the information of [r]egiters or [w]atchpoints", cmd_info },
+  { "info", "Print the information of [r]egiters, [w]atchpoints, [b]reakpoints or [c]heckpoints", cmd_info },
   { "x", "Scan the memory for [N] words begins with the value of [EXPR]", cmd_x },
   { "p", "Print the value of [EXPR]", cmd_p},
   { "w", "Set a watchpoint with [EXPR]", cmd_w},
-  { "d", "Delete a watchpoint with number [N]", cmd_d},
+  { "b", "Set a breakpoint at the address [EXPR]", cmd_b},
+  { "d", "Delete a watchpoint with number [N], or a breakpoint at [ADDR] in hexadecimal", cmd_d},
+  { "save", "Save the snapshot of the machine to [FILE]", cmd_save},
+  { "load", "Restore the machine from the snapshot in [FILE]", cmd_load},
+  { "checkpoint", "Take a checkpoint, and take one every [N] instructions if N is given (0 to stop)", cmd_checkpoint},
+  { "restart", "Restart from the checkpoint [N]", cmd_restart},
+  { "rsi", "Go back by [N] instructions", cmd_rsi},
+  { "rc", "Go back to the last point stopped at by breakpoints or watchpoints", cmd_rc},
+#ifdef CONFIG_ITRACE_RING
+  { "itrace", "Dump the recent instructions to [FILE] for tools/itrace-dis", cmd_itrace},
+#endif
+#ifdef CONFIG_TRACE
+  { "trace", "Show the triggers of tracing, or set them by on, off, clear, instr [START] [END], "
+    "pc [LO[, HI]], func [NAME] or if [EXPR] (without arguments to remove the trigger)", cmd_trace},
+#endif
 
   // TODO: Add more commands
 
@@ -214,13 +437,29 @@ void sdb_set_batch_mode() {
   is_batch_mode = true;
 }
 
-void sdb_mainloop() {
+void sdb_set_gdb_port(int port) {
+  gdb_port = port;
+}
+
+void sdb_set_save_file(char *file) {
+  save_file = file;
+}
+
+static void sdb_loop() {
+  if (gdb_port != 0) {
+    gdb_mainloop(gdb_port);
+    return;
+  }
+
   if (is_batch_mode) {
     cmd_c(NULL);
     return;
   }
 
-  for (char *str; (str = rl_gets()) != NULL; ) {
+  while (true) {
+    reverse_finish();
+    char *str = rl_gets();
+    if (str == NULL) break;
     char *str_end = str + strlen(str);
 
     /* extract the first token as the command */
@@ -254,10 +493,13 @@ void sdb_mainloop() {
   }
 }
 
-void init_sdb() {
-  /* Compile the regular expressions. */
-  init_regex();
+void sdb_mainloop() {
+  sdb_loop();
+  if (save_file != NULL) save_snapshot(save_file);
+  exit_checkpoint();
+}
 
+void init_sdb() {
   /* Initialize the watchpoint pool. */
   init_wp_pool();
 }
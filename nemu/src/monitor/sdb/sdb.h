@@ -3,9 +3,49 @@
 
 #include <common.h>
 
+#define NR_WP 32
+#define NR_BP 128
+#define WP_EXPR_LEN 128
+
 int del_wp(int wp_no);
 int add_wp(char* e);
+int add_wp_mem(paddr_t addr, int len);
+int del_wp_mem(paddr_t addr, int len);
 void display_wp();
+int get_wps(char (*e)[WP_EXPR_LEN], int *len);
+void clear_wps();
+bool check_bp(vaddr_t pc);
+int add_bp(vaddr_t pc);
+int del_bp(vaddr_t pc);
+void display_bp();
+int get_bps(vaddr_t *pcs);
+void clear_bps();
 word_t expr(char *e, bool *success);
 
+typedef struct Expr Expr;
+Expr* expr_compile(char *e);
+word_t expr_eval(const Expr *e, bool *success);
+bool expr_is_deref_const(const Expr *e, word_t *addr);
+
+void trace_update(vaddr_t pc);
+void trace_set_enable(bool enable);
+void trace_set_window(uint64_t start, uint64_t end);
+void trace_set_pc(vaddr_t lo, vaddr_t hi);
+void trace_set_func(int idx);
+bool trace_set_cond(char *e);
+void trace_clear();
+void trace_display();
+
+bool save_snapshot(const char *file);
+bool load_snapshot(const char *file);
+
+int take_checkpoint(bool is_auto, bool *restarted);
+int restart_checkpoint(int id);
+void set_checkpoint_interval(uint64_t n);
+void display_checkpoint();
+void exit_checkpoint();
+void reverse_step(uint64_t n);
+void reverse_continue();
+void reverse_finish();
+
 #endif
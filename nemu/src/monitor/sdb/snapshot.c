@@ -0,0 +1,151 @@
+#include <isa.h>
+#include <memory/paddr.h>
+#include <memory/vaddr.h>
+#include <device/map.h>
+#include <sys/stat.h>
+#include "sdb.h"
+
+/* Snapshots of the whole machine. A snapshot contains the CPU state, the
+ * state of NEMU, the dirty pages of pmem (see paddr_is_dirty()),
+ * and the non-zero pages of the device register spaces allocated by
+ * new_space(). Each page is compressed by
+ * lz_compress(), or stored as it is if it can not be compressed.
+ * The file is laid out as
+ *   SnapHeader | CPU_state | pages of pmem | pages of io space
+ * where each page is a SnapPage followed by its data, and the pages of
+ * each region end with a SnapPage whose `idx` is SNAP_END.
+ */
+
+#define SNAP_MAGIC 0x50414e53 // "SNAP"
+#define SNAP_VERSION 1
+#define SNAP_END UINT32_MAX
+
+extern uint64_t g_nr_guest_instr;
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  char isa[16];
+  uint32_t cpu_size;
+  uint32_t io_size;
+  uint64_t mbase;
+  uint64_t msize;
+  uint64_t nr_instr;
+  NEMUState state;
+} SnapHeader;
+
+typedef struct {
+  uint32_t idx;  // the index of the page in the region
+  uint32_t size; // the size of the data, PAGE_SIZE if it is not compressed
+} SnapPage;
+
+static void save_region(FILE *fp, uint8_t *base, long size, bool is_pmem) {
+  static const uint8_t zero[PAGE_SIZE] = {};
+  static uint32_t htab[LZ_HTAB_SIZE];
+  uint8_t buf[PAGE_SIZE];
+  long i;
+  for (i = 0; i < size; i += PAGE_SIZE) {
+    uint8_t *p = base + i;
+    if (is_pmem ? !paddr_is_dirty(CONFIG_MBASE + i) : memcmp(p, zero, PAGE_SIZE) == 0) continue;
+    int n = lz_compress(p, PAGE_SIZE, buf, PAGE_SIZE - 1, htab);
+    SnapPage pg = { .idx = i / PAGE_SIZE, .size = (n == 0 ? PAGE_SIZE : n) };
+    fwrite(&pg, sizeof(pg), 1, fp);
+    fwrite(n == 0 ? p : buf, pg.size, 1, fp);
+  }
+  SnapPage end = { .idx = SNAP_END, .size = 0 };
+  fwrite(&end, sizeof(end), 1, fp);
+}
+
+// return the position after the region in `buf`, or NULL if it is corrupted
+static uint8_t* load_region(uint8_t *buf, uint8_t *buf_end, uint8_t *base, long size, bool is_pmem) {
+  while (buf + sizeof(SnapPage) <= buf_end) {
+    SnapPage pg;
+    memcpy(&pg, buf, sizeof(pg));
+    buf += sizeof(pg);
+    if (pg.idx == SNAP_END) return buf;
+    if ((long)pg.idx * PAGE_SIZE >= size || pg.size > PAGE_SIZE || buf + pg.size > buf_end) break;
+    uint8_t *p = base + (long)pg.idx * PAGE_SIZE;
+    if (pg.size == PAGE_SIZE) memcpy(p, buf, PAGE_SIZE);
+    else if (lz_decompress(buf, pg.size, p, PAGE_SIZE) != PAGE_SIZE) break;
+    buf += pg.size;
+  }
+  return NULL;
+}
+
+bool save_snapshot(const char *file) {
+  FILE *fp = fopen(file, "wb");
+  if (fp == NULL) {
+    printf("Can not open '%s'\n", file);
+    return false;
+  }
+
+  int io_size = 0;
+  uint8_t *io = io_space_used(&io_size);
+  SnapHeader h = { .magic = SNAP_MAGIC, .version = SNAP_VERSION, .isa = str(__GUEST_ISA__),
+    .cpu_size = sizeof(CPU_state), .io_size = io_size,
+    .mbase = CONFIG_MBASE, .msize = CONFIG_MSIZE,
+    .nr_instr = g_nr_guest_instr, .state = nemu_state };
+  fwrite(&h, sizeof(h), 1, fp);
+  fwrite(&cpu, sizeof(cpu), 1, fp);
+  save_region(fp, guest_to_host(CONFIG_MBASE), CONFIG_MSIZE, true);
+  save_region(fp, io, io_size, false);
+  long size = ftell(fp);
+  fclose(fp);
+
+  Log("Save the snapshot at pc = " FMT_WORD " to %s, size = %ld", cpu.pc, file, size);
+  return true;
+}
+
+bool load_snapshot(const char *file) {
+  FILE *fp = fopen(file, "rb");
+  if (fp == NULL) {
+    printf("Can not open '%s'\n", file);
+    return false;
+  }
+
+  // read the whole file at once
+  struct stat st;
+  fstat(fileno(fp), &st);
+  uint8_t *buf = malloc(st.st_size);
+  assert(buf);
+  int ret = fread(buf, st.st_size, 1, fp);
+  fclose(fp);
+
+  SnapHeader h = {};
+  int io_size = 0;
+  uint8_t *io = io_space_used(&io_size);
+  if (ret == 1 && st.st_size >= sizeof(h) + sizeof(cpu)) memcpy(&h, buf, sizeof(h));
+  if (h.magic != SNAP_MAGIC || h.version != SNAP_VERSION) {
+    printf("'%s' is not a snapshot of NEMU\n", file);
+    free(buf);
+    return false;
+  }
+  if (strcmp(h.isa, str(__GUEST_ISA__)) != 0 || h.cpu_size != sizeof(CPU_state) ||
+      h.io_size != io_size || h.mbase != CONFIG_MBASE || h.msize != CONFIG_MSIZE) {
+    printf("'%s' is saved by a different build of NEMU\n", file);
+    free(buf);
+    return false;
+  }
+
+  // the pages not in the snapshot hold their initial values
+  paddr_reset();
+  memset(io, 0, io_size);
+
+  uint8_t *p = buf + sizeof(h) + sizeof(cpu);
+  uint8_t *end = buf + st.st_size;
+  p = load_region(p, end, guest_to_host(CONFIG_MBASE), CONFIG_MSIZE, true);
+  if (p != NULL) p = load_region(p, end, io, io_size, false);
+  // the state is partly overwritten, so it is too late to give up
+  Assert(p != NULL, "'%s' is corrupted", file);
+
+  memcpy(&cpu, buf + sizeof(h), sizeof(cpu));
+  g_nr_guest_instr = h.nr_instr;
+  nemu_state = h.state;
+  if (nemu_state.state == NEMU_RUNNING || nemu_state.state == NEMU_QUIT) {
+    nemu_state.state = NEMU_STOP;
+  }
+  free(buf);
+
+  Log("Load the snapshot at pc = " FMT_WORD " from %s", cpu.pc, file);
+  return true;
+}
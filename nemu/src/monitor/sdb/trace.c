@@ -0,0 +1,144 @@
+#include <isa.h>
+#include "sdb.h"
+
+#ifdef CONFIG_TRACE
+
+/* The trace (the log of instructions, function calls and so on) is only
+ * written while `g_trace_on` is set. It is decided before each instruction
+ * by the triggers below, and tracing is on only if all the armed triggers
+ * agree, and it is not turned off by the `trace off` command:
+ *   - the window of instructions [instr_start, instr_end], counted from 1,
+ *     initially [CONFIG_TRACE_START, CONFIG_TRACE_END]
+ *   - the PC range [pc_lo, pc_hi)
+ *   - the function, from a call to it until the matching return, including
+ *     the functions it calls, which is followed by the shadow stack of ftrace
+ *   - the condition, an expression compiled by expr_compile()
+ * The window is checked by comparing with `g_trace_instr` as checkpoints
+ * do, so that it costs nothing between its boundaries. The function sets
+ * `g_trace_instr` to 0 on entering and leaving to be checked again. The
+ * others are checked before each instruction only when they are armed.
+ */
+
+extern uint64_t g_nr_guest_instr;
+extern bool g_trace_on;
+
+// checked by cpu_exec() before calling trace_update()
+uint64_t g_trace_instr = 0;
+bool g_trace_check = false;
+
+static bool is_off = false;
+static uint64_t instr_start = CONFIG_TRACE_START, instr_end = CONFIG_TRACE_END;
+static bool has_pc = false;
+static vaddr_t pc_lo = 0, pc_hi = 0;
+static int func = -1; // the index of the symbol
+static int func_depth = 0; // the depth of its outermost frame, 0 if not in it
+static Expr *cond = NULL;
+static char *cond_str = NULL;
+
+void trace_update(vaddr_t pc) {
+  // the instruction to execute is the (g_nr_guest_instr + 1)-th one
+  uint64_t n = g_nr_guest_instr + 1;
+  if (n < instr_start) g_trace_instr = instr_start - 1;
+  else if (n <= instr_end && instr_end != UINT64_MAX) g_trace_instr = instr_end;
+  else g_trace_instr = UINT64_MAX;
+
+  bool on = !is_off && n >= instr_start && n <= instr_end;
+  if (on && has_pc) on = (pc >= pc_lo && pc < pc_hi);
+  if (on && func >= 0) on = (func_depth > 0);
+  if (on && cond != NULL) {
+    bool success;
+    on = (expr_eval(cond, &success) != 0) && success;
+  }
+  g_trace_on = on;
+}
+
+static void rearm() {
+  g_trace_check = has_pc || cond != NULL;
+  trace_update(cpu.pc);
+}
+
+void trace_set_enable(bool enable) {
+  is_off = !enable;
+  rearm();
+}
+
+void trace_set_window(uint64_t start, uint64_t end) {
+  instr_start = start;
+  instr_end = end;
+  rearm();
+}
+
+void trace_set_pc(vaddr_t lo, vaddr_t hi) {
+  has_pc = (lo < hi);
+  pc_lo = lo;
+  pc_hi = hi;
+  rearm();
+}
+
+// `idx` is the index of the symbol, or -1 to remove the trigger
+void trace_set_func(int idx) {
+  int ftrace_frame(int func);
+  func = idx;
+  func_depth = (idx >= 0 ? MUXDEF(CONFIG_FTRACE, ftrace_frame(idx), 0) : 0);
+  rearm();
+}
+
+// called by ftrace after pushing the frame of `f` at `depth`
+void trace_func_enter(int f, int depth) {
+  if (func >= 0 && f == func && func_depth == 0) {
+    func_depth = depth;
+    g_trace_instr = 0;
+  }
+}
+
+// called by ftrace after popping the frames above `depth`
+void trace_func_leave(int depth) {
+  if (func_depth > depth) {
+    func_depth = 0;
+    g_trace_instr = 0;
+  }
+}
+
+// return false if `e` is not a legal expression
+bool trace_set_cond(char *e) {
+  Expr *code = NULL;
+  if (e != NULL) {
+    code = expr_compile(e);
+    if (code == NULL) return false;
+  }
+  free(cond);
+  free(cond_str);
+  cond = code;
+  cond_str = (e == NULL ? NULL : strdup(e));
+  rearm();
+  return true;
+}
+
+void trace_clear() {
+  free(cond);
+  free(cond_str);
+  cond = NULL;
+  cond_str = NULL;
+  has_pc = false;
+  func = -1;
+  func_depth = 0;
+  instr_start = 0;
+  instr_end = UINT64_MAX;
+  rearm();
+}
+
+void trace_display() {
+  printf("Tracing is %s%s\n", g_trace_on ? "on" : "off", is_off ? " (turned off by the user)" : "");
+  if (instr_start > 0 || instr_end != UINT64_MAX) {
+    printf("  instructions [%lu, ", instr_start);
+    if (instr_end == UINT64_MAX) printf("-]\n");
+    else printf("%lu]\n", instr_end);
+  }
+  if (has_pc) printf("  pc [" FMT_WORD ", " FMT_WORD ")\n", pc_lo, pc_hi);
+  if (func >= 0) {
+    printf("  func %s (%s)\n", symbol_get(func)->name, func_depth > 0 ? "entered" : "not entered");
+  }
+  if (cond_str != NULL) printf("  if %s\n", cond_str);
+}
+
+#endif
@@ -1,21 +1,27 @@
 #include "sdb.h"
+#include <memory/paddr.h>
 #include <string.h>
 #include <stdlib.h>
 
-#define NR_WP 32
-
 typedef struct watchpoint {
   int NO;
   struct watchpoint *next;
 
   /* TODO: Add more members if necessary */
   char *e;
+  Expr *code;
   word_t old_val; 
+  bool is_mem;     // watched by the memory, see paddr_watch()
+  paddr_t addr;
+  int len;
 
 } WP;
 
 static WP wp_pool[NR_WP] = {};
 static WP *head = NULL, *free_ = NULL;
+// the number of watchpoints which should be checked after every instruction
+static int nr_expr_wp = 0;
+static WP *last_hit = NULL;
 
 void init_wp_pool() {
   int i;
@@ -45,7 +51,16 @@ static inline void free_wp(WP *wp)
   if (wp == NULL) {
     return;
   }
+  if (wp->is_mem) {
+    paddr_watch(wp->addr, wp->len, false);
+  } else {
+    nr_expr_wp --;
+  }
+  if (wp == last_hit) {
+    last_hit = NULL;
+  }
   free(wp->e);
+  free(wp->code);
   wp->next = free_;
   free_ = wp;
 }
@@ -77,42 +92,134 @@ int add_wp(char* e)
   bool success = true;
   word_t old_val;
 
-  old_val = expr(e, &success);
+  // compile it only once, and evaluate the code after every instruction
+  Expr *code = expr_compile(e);
+  if (code == NULL) {
+    return 3;
+  }
+  old_val = expr_eval(code, &success);
   if (success == false) {
+    free(code);
     return 3;
   }
 
   if ((wp = alloc_wp()) == NULL) {
+    free(code);
     return 2;
   }
   wp->e = strdup(e);
+  wp->code = code;
   wp->old_val = old_val;
+
+  // `*ADDR` only changes when there is a store to ADDR,
+  // so let the memory tell us instead of checking it every time
+  word_t addr;
+  wp->is_mem = expr_is_deref_const(code, &addr) && in_pmem(addr) && in_pmem(addr + 3);
+  if (wp->is_mem) {
+    wp->addr = addr;
+    wp->len = 4;
+    paddr_watch(addr, 4, true);
+  } else {
+    nr_expr_wp ++;
+  }
   return 0;
 }
 
+// watch `len` bytes at `addr`, return the number of the watchpoint or -1
+int add_wp_mem(paddr_t addr, int len)
+{
+  WP *wp;
+  if (!in_pmem(addr) || !in_pmem(addr + len - 1) || (wp = alloc_wp()) == NULL) {
+    return -1;
+  }
+  char buf[32];
+  snprintf(buf, sizeof(buf), "*" FMT_PADDR, addr);
+  wp->e = strdup(buf);
+  wp->code = NULL;
+  wp->is_mem = true;
+  wp->addr = addr;
+  wp->len = len;
+  wp->old_val = paddr_peek(addr, len);
+  paddr_watch(addr, len, true);
+  return wp->NO;
+}
+
+int del_wp_mem(paddr_t addr, int len)
+{
+  for (WP *wp = head; wp != NULL; wp = wp->next) {
+    if (wp->is_mem && wp->addr == addr && wp->len == len) {
+      return del_wp(wp->NO);
+    }
+  }
+  return 1;
+}
+
+// return the number of the last watchpoint hit, or -1 if there is not
+int wp_last_hit(paddr_t *addr)
+{
+  if (last_hit == NULL) {
+    return -1;
+  }
+  int NO = last_hit->NO;
+  *addr = last_hit->addr;
+  last_hit = NULL;
+  return NO;
+}
+
 bool check_wp(word_t pc)
 {
   bool success = true, change = false;
+  bool is_mem_hit = paddr_watch_hit();
+  if (nr_expr_wp == 0 && !is_mem_hit) {
+    return false;
+  }
   for (WP *wp = head; wp != NULL; wp = wp->next) {
-    word_t val = expr(wp->e, &success);
-    if (val != wp->old_val) {
+    if (wp->is_mem && !is_mem_hit) {
+      continue;
+    }
+    word_t val = (wp->is_mem ? paddr_peek(wp->addr, wp->len) : expr_eval(wp->code, &success));
+    if (success && val != wp->old_val) {
       printf("Hit watchpoint %d at 0x%08x.\n", wp->NO, pc);
       wp->old_val = val;
+      last_hit = wp;
       change = true;
     }
   }
   return change;
 }
 
+// copy the expressions of the watchpoints to `e`, return the number of them,
+// `len` is the length watched by the ones set by add_wp_mem(), and 0 for the others
+int get_wps(char (*e)[WP_EXPR_LEN], int *len)
+{
+  int n = 0;
+  for (WP *wp = head; wp != NULL; wp = wp->next) {
+    if (strlen(wp->e) >= WP_EXPR_LEN) {
+      printf("Watchpoint %d is too long to be copied.\n", wp->NO);
+      continue;
+    }
+    len[n] = (wp->code == NULL ? wp->len : 0);
+    strcpy(e[n ++], wp->e);
+  }
+  return n;
+}
+
+void clear_wps()
+{
+  while (head != NULL) {
+    del_wp(head->NO);
+  }
+}
+
 void display_wp()
 {
   if (head == NULL) {
     printf("There is no watchpoint set.\n");
     return;
   }
-  printf("%8s\t%8s\n", "NO", "EXPR");
+  printf("%8s\t%8s\t%s\n", "NO", "TYPE", "EXPR");
   for (WP *wp = head; wp != NULL; wp = wp->next) {
-    printf("%8d\t%8s\n", wp->NO, wp->e);
+    printf("%8d\t%8s\t%s\n", wp->NO, wp->is_mem ? "memory" : "expr", wp->e);
   }
   return;
 }
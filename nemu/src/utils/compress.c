@@ -0,0 +1,106 @@
+#include <stdint.h>
+#include <string.h>
+
+/* A small LZ77 codec in the format of LZF. It is much faster than
+ * general-purpose compressors, and is good enough for the memory of
+ * the guest, which is full of repeated words. The compressed data is
+ * a sequence of the following items:
+ *   000LLLLL <L+1 literal bytes>
+ *   LLLOOOOO OOOOOOOO           copy L+2 bytes from O+1 bytes before
+ *   111OOOOO LLLLLLLL OOOOOOOO  copy L+9 bytes from O+1 bytes before
+ */
+
+#define HASH_BITS 13 // LZ_HTAB_SIZE in utils.h is (1 << HASH_BITS)
+#define MAX_LIT 32
+#define MAX_OFF (1 << 13)
+#define MAX_REF (7 + 255 + 2)
+
+static inline uint32_t hash3(const uint8_t *p) {
+  uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16);
+  return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+// return the size of the compressed data, or 0 if it does not fit in `out_len`;
+// `htab` is given by the caller, and need not be cleared for each call,
+// since the positions in it are checked before being used
+int lz_compress(const void *in, int in_len, void *out, int out_len, uint32_t *htab) {
+  const uint8_t *ip = in;
+  uint8_t *op = out;
+  int i = 0, o = 1, lit = 0, lit_ctrl = 0;
+
+  if (out_len < 1) return 0;
+  while (i < in_len) {
+    if (i + 2 < in_len) {
+      uint32_t h = hash3(ip + i);
+      uint32_t ref = htab[h];
+      htab[h] = i;
+      uint32_t off = i - ref - 1;
+      if (ref < i && off < MAX_OFF && memcmp(ip + ref, ip + i, 3) == 0) {
+        int max = (in_len - i < MAX_REF ? in_len - i : MAX_REF);
+        int len = 3;
+        while (len < max && ip[ref + len] == ip[i + len]) len ++;
+
+        // close the literal run, or drop its empty control byte
+        if (lit > 0) op[lit_ctrl] = lit - 1;
+        else o --;
+        if (o + 3 + 1 > out_len) return 0;
+        int l = len - 2;
+        if (l < 7) {
+          op[o ++] = (l << 5) | (off >> 8);
+        } else {
+          op[o ++] = (7 << 5) | (off >> 8);
+          op[o ++] = l - 7;
+        }
+        op[o ++] = off & 0xff;
+        i += len;
+        lit = 0;
+        lit_ctrl = o ++;
+        continue;
+      }
+    }
+
+    if (o >= out_len) return 0;
+    op[o ++] = ip[i ++];
+    if (++ lit == MAX_LIT) {
+      op[lit_ctrl] = MAX_LIT - 1;
+      lit = 0;
+      if (o >= out_len) return 0;
+      lit_ctrl = o ++;
+    }
+  }
+
+  if (lit > 0) op[lit_ctrl] = lit - 1;
+  else o --;
+  return o;
+}
+
+// return the size of the decompressed data, or -1 if `in` is corrupted
+int lz_decompress(const void *in, int in_len, void *out, int out_len) {
+  const uint8_t *ip = in;
+  uint8_t *op = out;
+  int i = 0, o = 0;
+
+  while (i < in_len) {
+    uint32_t c = ip[i ++];
+    if (c < MAX_LIT) {
+      int n = c + 1;
+      if (i + n > in_len || o + n > out_len) return -1;
+      memcpy(op + o, ip + i, n);
+      i += n;
+      o += n;
+    } else {
+      int len = c >> 5;
+      if (len == 7) {
+        if (i >= in_len) return -1;
+        len += ip[i ++];
+      }
+      if (i >= in_len) return -1;
+      int ref = o - (((c & 0x1f) << 8) | ip[i ++]) - 1;
+      len += 2;
+      if (ref < 0 || o + len > out_len) return -1;
+      // the ranges may overlap, so copy byte by byte
+      while (len --) op[o ++] = op[ref ++];
+    }
+  }
+  return o;
+}
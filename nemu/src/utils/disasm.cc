@@ -55,18 +55,105 @@ extern "C" void init_disasm(const char *triple) {
   gIP->setPrintBranchImmAsAddress(true);
 }
 
+static void print_inst(std::string &s, MCInst &inst, uint64_t pc) {
+  s.clear();
+  raw_string_ostream os(s);
+  gIP->printInst(&inst, pc, "", *gSTI, os);
+  os.flush();
+  s.erase(0, s.find_first_not_of('\t'));
+}
+
+/* Loops execute the same instructions over and over, so the text of each
+ * instruction is cached by its bytes. The text of an instruction with a
+ * PC-relative operand (e.g. the target of a branch) depends on the PC, so
+ * only the text around the operand is cached, together with the distance
+ * from the PC to the operand, and the operand is patched in on output. */
+
+#define CACHE_BITS 12
+#define CACHE_TEXT_LEN 96
+
+typedef struct {
+  uint8_t code[16];
+  uint8_t nbyte;
+  bool pcrel;
+  uint8_t split;   // the position of the operand in `text` if `pcrel`
+  int64_t offset;  // the distance from the PC to the operand if `pcrel`
+  char text[CACHE_TEXT_LEN];
+} DisasmCache;
+
+static DisasmCache cache[1 << CACHE_BITS];
+
+static uint32_t cache_idx(const uint8_t *code, int nbyte) {
+  uint32_t h = nbyte;
+  for (int i = 0; i < nbyte; i ++) h = (h ^ code[i]) * 16777619u;
+  return h >> (32 - CACHE_BITS);
+}
+
+static int render(const DisasmCache *c, char *str, int size, uint64_t pc) {
+  if (!c->pcrel) return snprintf(str, size, "%s", c->text);
+  uint64_t addr = pc + c->offset;
+  if (!gSTI->getTargetTriple().isArch64Bit()) addr = (uint32_t)addr;
+  return snprintf(str, size, "%.*s0x%" PRIx64 "%s",
+      c->split, c->text, addr, c->text + c->split);
+}
+
+// fill `c` with the text `s` at `pc`, and `s2` at `pc2`
+static bool fill_cache(DisasmCache *c, const std::string &s,
+    uint64_t pc, const std::string &s2, uint64_t pc2) {
+  if (s.length() >= CACHE_TEXT_LEN) return false;
+  if (s == s2) {
+    c->pcrel = false;
+    strcpy(c->text, s.c_str());
+    return true;
+  }
+
+  // find the hexadecimal operand which changes with the PC
+  size_t diff = 0;
+  while (s[diff] == s2[diff]) diff ++;
+  size_t start = s.rfind("0x", diff);
+  if (start == std::string::npos) return false;
+  size_t end = start + 2;
+  while (end < s.length() && isxdigit(s[end])) end ++;
+  if (diff > end) return false;
+
+  uint64_t addr = strtoull(s.c_str() + start, NULL, 16);
+  std::string text = s.substr(0, start) + s.substr(end);
+  c->pcrel = true;
+  c->split = start;
+  c->offset = addr - pc;
+  strcpy(c->text, text.c_str());
+
+  // make sure that the operand is the only difference
+  char buf[CACHE_TEXT_LEN + 32];
+  render(c, buf, sizeof(buf), pc2);
+  return s2 == buf;
+}
+
 extern "C" void disassemble(char *str, int size, uint64_t pc, uint8_t *code, int nbyte) {
+  DisasmCache *c = &cache[cache_idx(code, nbyte)];
+  if (c->nbyte == nbyte && memcmp(c->code, code, nbyte) == 0) {
+    int len = render(c, str, size, pc);
+    assert(len < size);
+    return;
+  }
+
   MCInst inst;
   llvm::ArrayRef<uint8_t> arr(code, nbyte);
   uint64_t dummy_size = 0;
   gDisassembler->getInstruction(inst, dummy_size, arr, pc, llvm::nulls());
 
-  std::string s;
-  raw_string_ostream os(s);
-  gIP->printInst(&inst, pc, "", *gSTI, os);
+  std::string s, s2;
+  print_inst(s, inst, pc);
+  assert((int)s.length() < size);
+  strcpy(str, s.c_str());
 
-  int skip = s.find_first_not_of('\t');
-  const char *p = s.c_str() + skip;
-  assert((int)s.length() - skip < size);
-  strcpy(str, p);
+  // print it at another PC to find out whether it is PC-relative
+  uint64_t pc2 = pc ^ 0x1000;
+  print_inst(s2, inst, pc2);
+  if (nbyte <= (int)sizeof(c->code) && fill_cache(c, s, pc, s2, pc2)) {
+    memcpy(c->code, code, nbyte);
+    c->nbyte = nbyte;
+  } else {
+    c->nbyte = 0;
+  }
 }
@@ -0,0 +1,125 @@
+#include <common.h>
+#include <unistd.h>
+#include <time.h>
+#include <inttypes.h>
+
+#ifdef CONFIG_EVENT_TRACE
+
+/* The begin/end events of spans, recorded in a buffer of each thread
+ * without locking, and written in the JSON format of Chrome trace at
+ * exit, which can be opened by chrome://tracing or ui.perfetto.dev.
+ * When the buffer is full, the new spans are dropped as a whole, so
+ * that the recorded events are always paired. The threads are numbered
+ * by their first events, and the thread calling init_event_trace() is 0.
+ */
+
+#define MAX_THREAD 8
+
+typedef struct {
+  uint64_t ns;
+  const char *name;
+  char ph;  // 'B' or 'E'
+} Event;
+
+typedef struct {
+  Event *ev;
+  int nr;
+  int nr_open;  // the spans recorded but not ended
+  int nr_skip;  // the spans dropped but not ended
+  uint64_t nr_drop;
+} EventBuf;
+
+static EventBuf buf[MAX_THREAD] = {};
+static int nr_thread = 0;
+static __thread EventBuf *tls = NULL;
+static uint64_t start_ns = 0;
+
+static inline uint64_t now_ns() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000000000ull + t.tv_nsec;
+}
+
+static EventBuf* get_buf() {
+  if (likely(tls != NULL)) return tls;
+  int i = __atomic_fetch_add(&nr_thread, 1, __ATOMIC_RELAXED);
+  if (i >= MAX_THREAD) return NULL;
+  EventBuf *b = &buf[i];
+  b->ev = malloc(sizeof(Event) * CONFIG_EVENT_TRACE_SIZE);
+  assert(b->ev);
+  tls = b;
+  return b;
+}
+
+void event_begin(const char *name) {
+  EventBuf *b = get_buf();
+  if (b == NULL) return;
+  // leave room for the end events of this span and the open ones
+  if (b->nr_skip > 0 || b->nr + b->nr_open + 2 > CONFIG_EVENT_TRACE_SIZE) {
+    b->nr_skip ++;
+    b->nr_drop ++;
+    return;
+  }
+  b->ev[b->nr ++] = (Event) { .ns = now_ns(), .name = name, .ph = 'B' };
+  b->nr_open ++;
+}
+
+void event_end(const char *name) {
+  EventBuf *b = get_buf();
+  if (b == NULL) return;
+  if (b->nr_skip > 0) { b->nr_skip --; return; }
+  if (b->nr_open == 0) return;
+  b->ev[b->nr ++] = (Event) { .ns = now_ns(), .name = name, .ph = 'E' };
+  b->nr_open --;
+}
+
+// write `s` as a JSON string
+static void put_json_str(FILE *fp, const char *s) {
+  fputc('"', fp);
+  for (; *s != '\0'; s ++) {
+    if (*s == '"' || *s == '\\') fputc('\\', fp);
+    if ((uint8_t)*s < 0x20) fprintf(fp, "\\u%04x", *s);
+    else fputc(*s, fp);
+  }
+  fputc('"', fp);
+}
+
+static void event_dump() {
+  FILE *fp = fopen(CONFIG_EVENT_TRACE_FILE, "w");
+  if (fp == NULL) {
+    printf("Can not open '%s' to write the event trace\n", CONFIG_EVENT_TRACE_FILE);
+    return;
+  }
+  pid_t pid = getpid();
+  int n = (nr_thread < MAX_THREAD ? nr_thread : MAX_THREAD);
+  uint64_t nr_ev = 0, nr_drop = 0;
+  int i, j;
+  fprintf(fp, "{\"traceEvents\":[\n");
+  for (i = 0; i < n; i ++) {
+    EventBuf *b = &buf[i];
+    fprintf(fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+        "\"args\":{\"name\":\"%s\"}}", i ? ",\n" : "", pid, i, i == 0 ? "nemu" : "thread");
+    for (j = 0; j < b->nr; j ++) {
+      Event *e = &b->ev[j];
+      uint64_t ns = e->ns - start_ns;
+      fprintf(fp, ",\n{\"name\":");
+      put_json_str(fp, e->name);
+      fprintf(fp, ",\"ph\":\"%c\",\"ts\":%" PRIu64 ".%03" PRIu64 ",\"pid\":%d,\"tid\":%d}",
+          e->ph, ns / 1000, ns % 1000, pid, i);
+    }
+    nr_ev += b->nr;
+    nr_drop += b->nr_drop;
+  }
+  fprintf(fp, "\n],\"displayTimeUnit\":\"ns\"}\n");
+  fclose(fp);
+  printf("%" PRIu64 " events are written to %s", nr_ev, CONFIG_EVENT_TRACE_FILE);
+  if (nr_drop > 0) printf(", %" PRIu64 " spans are dropped since the buffer is full", nr_drop);
+  printf("\n");
+}
+
+void init_event_trace() {
+  start_ns = now_ns();
+  get_buf();
+  atexit(event_dump);
+}
+#endif
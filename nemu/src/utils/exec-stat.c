@@ -0,0 +1,50 @@
+#include <common.h>
+
+#ifdef CONFIG_EXEC_STAT
+
+/* The basic blocks executed are counted by their entry PC. A basic block
+ * starts after each instruction which does not fall through. The
+ * instructions executed are counted by EXEC_ID in cpu-exec.c, where
+ * their names are known.
+ */
+
+static PCCounter block = {};
+static bool is_block_entry = true;
+
+// called after each instruction, `is_jump` if it does not fall through
+void exec_stat_block(vaddr_t pc, bool is_jump) {
+  if (is_block_entry) pc_count(&block, pc);
+  is_block_entry = is_jump;
+}
+
+void exec_stat_report(const uint64_t *exec_cnt, const char **exec_name, int n) {
+  uint64_t total = 0;
+  int i, k;
+  for (i = 0; i < n; i ++) total += exec_cnt[i];
+  if (total == 0) return;
+
+  Log("top instructions:");
+  uint64_t cnt[n];
+  memcpy(cnt, exec_cnt, sizeof(cnt));
+  for (k = 0; k < CONFIG_EXEC_STAT_TOP; k ++) {
+    int max = 0;
+    for (i = 1; i < n; i ++) {
+      if (cnt[i] > cnt[max]) max = i;
+    }
+    if (cnt[max] == 0) break;
+    Log("%7.2f%% " NUMBERIC_FMT "  %s", cnt[max] * 100.0 / total, cnt[max], exec_name[max]);
+    cnt[max] = 0;
+  }
+
+  PCCount *b = pc_count_sorted(&block);
+  uint64_t nr_entry = 0;
+  for (i = 0; i < block.nr; i ++) nr_entry += b[i].cnt;
+  Log("top basic blocks (%d blocks, " NUMBERIC_FMT " entries):", block.nr, nr_entry);
+  for (i = 0; i < block.nr && i < CONFIG_EXEC_STAT_TOP; i ++) {
+    char where[128];
+    symbol_where(b[i].pc, where, sizeof(where));
+    Log("%7.2f%% " NUMBERIC_FMT "  " FMT_WORD "  %s", b[i].cnt * 100.0 / nr_entry, b[i].cnt, b[i].pc, where);
+  }
+  free(b);
+}
+#endif
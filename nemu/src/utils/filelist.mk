@@ -3,3 +3,5 @@ CXXSRC = src/utils/disasm.cc
 CXXFLAGS += $(shell llvm-config-11 --cxxflags) -fPIE
 LIBS += $(shell llvm-config-11 --libs)
 endif
+
+LIBS += $(if $(CONFIG_MTRACE)$(CONFIG_LOG_ASYNC),-lpthread,)
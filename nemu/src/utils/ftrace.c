@@ -0,0 +1,196 @@
+#include <isa.h>
+
+#ifdef CONFIG_FTRACE
+
+/* The calls and returns are traced with a shadow call stack, and the
+ * instructions are counted in a calling context tree, where each node is
+ * a function called along a path from the root. The count of a node is
+ * only updated when the control leaves or enters it, and the tree is
+ * written in the folded format of flamegraph.pl at last.
+ */
+
+#define MAX_DEPTH 4096
+#define TOP_FUNC 10
+#define PATH_LEN 65536
+
+typedef struct {
+  int func;     // the index of the symbol, -1 if unknown
+  int parent;
+  int child;    // the first child
+  int sibling;  // the next sibling
+  uint64_t self;
+} Node;
+
+typedef struct {
+  int node;
+  vaddr_t ret;  // the return address of the call
+} Frame;
+
+extern uint64_t g_nr_guest_instr;
+// the trigger of tracing by function in src/monitor/sdb/trace.c
+void trace_func_enter(int func, int depth);
+void trace_func_leave(int depth);
+
+static bool is_enable = false;
+static Node *node = NULL;
+static int nr_node = 0, max_node = 0;
+static Frame stack[MAX_DEPTH];
+static int depth = 0;
+static int nr_overflow = 0; // the calls not pushed since the stack is full
+static uint64_t last_instr = 0;
+
+static const char* func_name(int func) {
+  const Symbol *s = symbol_get(func);
+  return (s ? s->name : "[unknown]");
+}
+
+static int new_node(int parent, int func) {
+  if (nr_node == max_node) {
+    max_node = (max_node == 0 ? 1024 : max_node * 2);
+    node = realloc(node, sizeof(Node) * max_node);
+    assert(node);
+  }
+  node[nr_node] = (Node) { .func = func, .parent = parent, .child = -1, .sibling = -1 };
+  if (parent >= 0) {
+    node[nr_node].sibling = node[parent].child;
+    node[parent].child = nr_node;
+  }
+  return nr_node ++;
+}
+
+static int get_child(int parent, int func) {
+  int c;
+  for (c = node[parent].child; c >= 0; c = node[c].sibling) {
+    if (node[c].func == func) return c;
+  }
+  return new_node(parent, func);
+}
+
+// charge the instructions since the last update to the current node,
+// including the jump being executed if `is_exec`
+static void update(bool is_exec) {
+  uint64_t now = g_nr_guest_instr + is_exec;
+  // the counter goes backward after loading a snapshot
+  if (now > last_instr) node[stack[depth].node].self += now - last_instr;
+  last_instr = now;
+}
+
+void ftrace_call(vaddr_t pc, vaddr_t target) {
+  if (!is_enable) return;
+  update(true);
+  int func = symbol_find(target);
+  log_write(FMT_WORD ": %*scall [%s@" FMT_WORD "]\n", pc, depth * 2, "", func_name(func), target);
+  if (depth + 1 == MAX_DEPTH) { nr_overflow ++; return; }
+  int n = get_child(stack[depth].node, func);
+  stack[++ depth] = (Frame) { .node = n, .ret = pc + 4 };
+  trace_func_enter(func, depth);
+}
+
+void ftrace_ret(vaddr_t pc, vaddr_t target) {
+  if (!is_enable) return;
+  update(true);
+  log_write(FMT_WORD ": %*sret  [%s]\n", pc, depth * 2, "", func_name(node[stack[depth].node].func));
+  if (nr_overflow > 0) { nr_overflow --; return; }
+  // pop the frames skipped by longjmp() as well
+  int d;
+  for (d = depth; d > 0 && stack[d].ret != target; d --);
+  if (d > 0) depth = d - 1;
+  else if (depth > 0) depth --;
+  trace_func_leave(depth);
+}
+
+// a jump to the entry of another function without linking is a tail call
+void ftrace_jump(vaddr_t pc, vaddr_t target) {
+  if (!is_enable || depth == 0) return;
+  int func = symbol_find(target);
+  const Symbol *t = symbol_get(func);
+  if (t == NULL || t->start != target) return;
+  const Symbol *s = symbol_get(node[stack[depth].node].func);
+  if (s && target >= s->start && target < s->end) return;
+  update(true);
+  log_write(FMT_WORD ": %*stail [%s@" FMT_WORD "]\n", pc, depth * 2, "", func_name(func), target);
+  stack[depth].node = get_child(stack[depth - 1].node, func);
+  trace_func_enter(func, depth);
+}
+
+// return the depth of the outermost frame of `func` in the shadow stack, or 0
+int ftrace_frame(int func) {
+  int d;
+  for (d = 1; d <= depth; d ++) {
+    if (node[stack[d].node].func == func) return d;
+  }
+  return 0;
+}
+
+void init_ftrace() {
+  if (symbol_nr() == 0) {
+    Log("No function symbols, run with --elf=FILE to enable ftrace");
+    return;
+  }
+  is_enable = true;
+  nr_node = 0;
+  stack[0] = (Frame) { .node = new_node(-1, symbol_find(cpu.pc)), .ret = 0 };
+  depth = 0;
+  last_instr = g_nr_guest_instr;
+}
+
+static uint64_t *excl = NULL, *incl = NULL;
+static int *on_path = NULL;
+
+// return the number of instructions in the subtree of `n`
+static uint64_t walk(FILE *fp, int n, char *path, int len) {
+  int f = node[n].func;
+  int l = len + snprintf(path + len, PATH_LEN - len, "%s%s", len ? ";" : "", func_name(f));
+  // the path is too long, charge the node to its parent
+  if (l >= PATH_LEN) { l = len; path[len] = '\0'; }
+  if (node[n].self > 0) fprintf(fp, "%s %lu\n", path, node[n].self);
+
+  // the unknown functions share the last slot
+  int i = (f >= 0 ? f : symbol_nr());
+  on_path[i] ++;
+  uint64_t total = node[n].self;
+  int c;
+  for (c = node[n].child; c >= 0; c = node[c].sibling) total += walk(fp, c, path, l);
+  on_path[i] --;
+
+  excl[i] += node[n].self;
+  // count a recursive function only once
+  if (on_path[i] == 0) incl[i] += total;
+  return total;
+}
+
+void ftrace_report(const char *file) {
+  if (!is_enable) return;
+  update(false);
+  FILE *fp = fopen(file, "w");
+  if (fp == NULL) {
+    Log("Can not open '%s' to write the profile", file);
+    return;
+  }
+
+  int n = symbol_nr() + 1;
+  excl = calloc(n, sizeof(excl[0]));
+  incl = calloc(n, sizeof(incl[0]));
+  on_path = calloc(n, sizeof(on_path[0]));
+  assert(excl && incl && on_path);
+  static char path[PATH_LEN];
+  uint64_t total = walk(fp, 0, path, 0);
+  fclose(fp);
+
+  // show the functions with the most exclusive instructions
+  Log("Profile in the folded format is written to %s, top functions:", file);
+  Log("%8s %14s %14s  %s", "excl%", "exclusive", "inclusive", "function");
+  int i, k;
+  for (k = 0; k < TOP_FUNC; k ++) {
+    int max = -1;
+    for (i = 0; i < n; i ++) {
+      if (excl[i] > 0 && (max < 0 || excl[i] > excl[max])) max = i;
+    }
+    if (max < 0) break;
+    Log("%7.2f%% %14lu %14lu  %s", excl[max] * 100.0 / (total ? total : 1),
+        excl[max], incl[max], func_name(max < n - 1 ? max : -1));
+    excl[max] = 0;
+  }
+  free(excl); free(incl); free(on_path);
+}
+#endif
@@ -0,0 +1,88 @@
+#include <common.h>
+#include <itrace-def.h>
+
+#ifdef CONFIG_ITRACE_RING
+
+#define NR_BLOCK (CONFIG_ITRACE_RING_SIZE / ITRACE_BLOCK_SIZE)
+static_assert(NR_BLOCK >= 2, "CONFIG_ITRACE_RING_SIZE is too small");
+
+static uint8_t ring[NR_BLOCK][ITRACE_BLOCK_SIZE];
+static ITraceBlock block[NR_BLOCK] = {};
+static uint64_t nr_block = 0; // the number of blocks ever started
+static uint8_t *pos = ring[0], *block_end = ring[0] + ITRACE_BLOCK_SIZE;
+static uint64_t nr_instr = 0;
+static uint64_t next_pc = 0;
+
+// the entries in the cache are only valid in the block of the same `gen`
+static ITraceCache cache[1 << ITRACE_CACHE_BITS] = {};
+static uint64_t cache_gen[1 << ITRACE_CACHE_BITS] = {};
+
+static void next_block() {
+  int cur = nr_block % NR_BLOCK;
+  block[cur].size = pos - ring[cur];
+  nr_block ++;
+  cur = nr_block % NR_BLOCK;
+  block[cur].first = nr_instr;
+  pos = ring[cur];
+  block_end = pos + ITRACE_BLOCK_SIZE;
+  next_pc = 0;
+}
+
+void itrace_record(vaddr_t pc, const uint8_t *instr, int ilen) {
+  if (unlikely(pos + ITRACE_MAX_ENTRY > block_end)) next_block();
+
+  uint8_t *h = pos ++;
+  *h = ilen << 2;
+  if (pc != next_pc) {
+    int64_t d = (uint64_t)pc - next_pc;
+    uint64_t v = ((uint64_t)d << 1) ^ (d >> 63);
+    *h |= ITRACE_PC_DELTA;
+    while (v >= 0x80) {
+      *pos ++ = v | 0x80;
+      v >>= 7;
+    }
+    *pos ++ = v;
+  }
+
+  uint32_t idx = itrace_cache_idx(pc);
+  ITraceCache *c = &cache[idx];
+  if (cache_gen[idx] == nr_block && c->pc == pc && c->ilen == ilen &&
+      memcmp(c->instr, instr, ilen) == 0) {
+    *h |= ITRACE_CACHED;
+  } else {
+    memcpy(pos, instr, ilen);
+    pos += ilen;
+    cache_gen[idx] = nr_block;
+    c->pc = pc;
+    c->ilen = ilen;
+    memcpy(c->instr, instr, ilen);
+  }
+  next_pc = pc + ilen;
+  nr_instr ++;
+}
+
+void itrace_dump(const char *file) {
+  FILE *fp = fopen(file, "wb");
+  if (fp == NULL) {
+    printf("Can not open '%s' to dump the instruction trace\n", file);
+    return;
+  }
+
+  int cur = nr_block % NR_BLOCK;
+  block[cur].size = pos - ring[cur];
+  uint64_t n = (nr_block + 1 < NR_BLOCK ? nr_block + 1 : NR_BLOCK);
+  ITraceHeader h = { .magic = ITRACE_MAGIC, .version = ITRACE_VERSION,
+    .isa = str(__GUEST_ISA__), .nr_block = n };
+  fwrite(&h, sizeof(h), 1, fp);
+  uint64_t i;
+  // from the oldest to the newest
+  for (i = nr_block + 1 - n; i <= nr_block; i ++) {
+    ITraceBlock *b = &block[i % NR_BLOCK];
+    fwrite(b, sizeof(*b), 1, fp);
+    fwrite(ring[i % NR_BLOCK], b->size, 1, fp);
+  }
+  fclose(fp);
+  Log("The last %lu instructions are dumped to %s, run tools/itrace-dis to disassemble them",
+      nr_instr - block[(nr_block + 1 - n) % NR_BLOCK].first, file);
+}
+#endif
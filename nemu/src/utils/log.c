@@ -3,17 +3,176 @@
 extern uint64_t g_nr_guest_instr;
 FILE *log_fp = NULL;
 
+#ifdef CONFIG_LOG_ASYNC
+#include <log-def.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <limits.h>
+#include <stdarg.h>
+
+/* The log is copied into a ring buffer, and written to the file by the
+ * writer thread. A producer reserves its space by moving `reserve_pos`,
+ * copies the text, and publishes it by moving `commit_pos` after the
+ * producers before it, so that no lock is needed. The bytes in
+ * [read_pos, commit_pos) are ready to be written.
+ */
+
+#define RING_SIZE CONFIG_LOG_ASYNC_BUF_SIZE
+static_assert((RING_SIZE & (RING_SIZE - 1)) == 0, "CONFIG_LOG_ASYNC_BUF_SIZE should be a power of 2");
+
+static char ring[RING_SIZE];
+static uint64_t reserve_pos = 0, commit_pos = 0, read_pos = 0;
+static bool is_async = false, is_quit = false;
+static pthread_t writer;
+static const char *log_path = NULL;
+static long file_size = 0;
+
+static inline uint64_t load(uint64_t *p) { return __atomic_load_n(p, __ATOMIC_ACQUIRE); }
+
+static void rotate() {
+  char from[PATH_MAX], to[PATH_MAX];
+  fclose(log_fp);
+  int i;
+  for (i = CONFIG_LOG_ROTATE_NUM - 1; i >= 1; i --) {
+    snprintf(from, sizeof(from), "%s.%d", log_path, i);
+    snprintf(to, sizeof(to), "%s.%d", log_path, i + 1);
+    rename(from, to);
+  }
+  snprintf(to, sizeof(to), "%s.1", log_path);
+  rename(log_path, to);
+  log_fp = fopen(log_path, "w");
+  assert(log_fp);
+  file_size = 0;
+}
+
+// write at most LOG_FRAME_MAX bytes, by the writer thread if it is running
+static void write_chunk(const char *p, int n) {
+#ifdef CONFIG_LOG_COMPRESS
+  static uint8_t buf[LOG_FRAME_MAX];
+  static uint32_t htab[LZ_HTAB_SIZE];
+  int size = lz_compress(p, n, buf, n - 1, htab);
+  LogFrame f = { .raw_size = n, .size = (size == 0 ? n : size) };
+  fwrite(&f, sizeof(f), 1, log_fp);
+  fwrite(size == 0 ? (const void *)p : buf, f.size, 1, log_fp);
+  file_size += sizeof(f) + f.size;
+#else
+  fwrite(p, n, 1, log_fp);
+  file_size += n;
+#endif
+  fflush(log_fp);
+  if (CONFIG_LOG_ROTATE_SIZE > 0 && file_size >= CONFIG_LOG_ROTATE_SIZE * 1048576L) rotate();
+}
+
+static void* writer_thread(void *arg) {
+  while (true) {
+    uint64_t r = read_pos, c = load(&commit_pos);
+    if (r == c) {
+      if (__atomic_load_n(&is_quit, __ATOMIC_ACQUIRE)) break;
+      usleep(1000);
+      continue;
+    }
+    // write at most a frame at once, and do not wrap around
+    uint64_t off = r & (RING_SIZE - 1);
+    uint64_t n = c - r;
+    if (n > RING_SIZE - off) n = RING_SIZE - off;
+    if (n > LOG_FRAME_MAX) n = LOG_FRAME_MAX;
+    write_chunk(ring + off, n);
+    __atomic_store_n(&read_pos, r + n, __ATOMIC_RELEASE);
+  }
+  return NULL;
+}
+
+static void log_async_write(const char *s, uint64_t len) {
+  // a message longer than the ring is written in pieces
+  for (; len > RING_SIZE; s += RING_SIZE, len -= RING_SIZE) log_async_write(s, RING_SIZE);
+  uint64_t start = __atomic_fetch_add(&reserve_pos, len, __ATOMIC_RELAXED);
+  // wait for the writer to free enough space
+  while (start + len - load(&read_pos) > RING_SIZE) sched_yield();
+  uint64_t off = start & (RING_SIZE - 1);
+  uint64_t n = (len < RING_SIZE - off ? len : RING_SIZE - off);
+  memcpy(ring + off, s, n);
+  memcpy(ring, s + n, len - n);
+  // wait for the producers before
+  while (load(&commit_pos) != start) sched_yield();
+  __atomic_store_n(&commit_pos, start + len, __ATOMIC_RELEASE);
+}
+
+void log_printf(const char *fmt, ...) {
+  char buf[1024], *p = buf;
+  va_list ap;
+  va_start(ap, fmt);
+  int len = vsnprintf(buf, sizeof(buf), fmt, ap);
+  va_end(ap);
+  if (len >= sizeof(buf)) {
+    p = malloc(len + 1);
+    assert(p);
+    va_start(ap, fmt);
+    vsnprintf(p, len + 1, fmt, ap);
+    va_end(ap);
+  }
+  if (is_async) log_async_write(p, len);
+  else if (log_path != NULL) {
+    // the writer has quit, so the rest is written here in the same format
+    int i, n;
+    for (i = 0; i < len; i += n) {
+      n = (len - i < LOG_FRAME_MAX ? len - i : LOG_FRAME_MAX);
+      write_chunk(p + i, n);
+    }
+  } else {
+    fwrite(p, len, 1, log_fp);
+    fflush(log_fp);
+  }
+  if (p != buf) free(p);
+}
+
+// wait until all the log is written
+void log_flush() {
+  if (!is_async) return;
+  while (load(&read_pos) != load(&reserve_pos)) usleep(100);
+}
+
+static void log_close() {
+  log_flush();
+  __atomic_store_n(&is_quit, true, __ATOMIC_RELEASE);
+  pthread_join(writer, NULL);
+  is_async = false;
+}
+
+// Only the calling thread survives fork() (see checkpoint.c), so the log
+// is flushed before, and the writer is restarted in the child.
+static void restart_writer() {
+  if (is_async) pthread_create(&writer, NULL, writer_thread, NULL);
+}
+
+static void init_log_async(const char *log_file) {
+  log_path = log_file;
+  is_async = true;
+  pthread_create(&writer, NULL, writer_thread, NULL);
+  pthread_atfork(log_flush, NULL, restart_writer);
+  atexit(log_close);
+}
+#endif
+
 void init_log(const char *log_file) {
   log_fp = stdout;
   if (log_file != NULL) {
     FILE *fp = fopen(log_file, "w");
     Assert(fp, "Can not open '%s'", log_file);
     log_fp = fp;
+    IFDEF(CONFIG_LOG_ASYNC, init_log_async(log_file));
   }
-  Log("Log is written to %s", log_file ? log_file : "stdout");
+  Log("Log is written to %s%s", log_file ? log_file : "stdout",
+      MUXDEF(CONFIG_LOG_COMPRESS, log_file ? ", run tools/log-unpack to decompress it" : "", ""));
 }
 
+// set by the triggers in src/monitor/sdb/trace.c
+bool g_trace_on = MUXDEF(CONFIG_TRACE, CONFIG_TRACE_START == 0, false);
+
 bool log_enable() {
-  return MUXDEF(CONFIG_TRACE, (g_nr_guest_instr >= CONFIG_TRACE_START) &&
-         (g_nr_guest_instr <= CONFIG_TRACE_END), false);
+  // the triggers are only in the native NEMU, and
+  // the others keep the window given by Kconfig
+  return MUXDEF(CONFIG_TARGET_NATIVE_ELF, g_trace_on,
+      MUXDEF(CONFIG_TRACE, (g_nr_guest_instr >= CONFIG_TRACE_START) &&
+        (g_nr_guest_instr <= CONFIG_TRACE_END), false));
 }
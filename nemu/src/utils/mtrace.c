@@ -0,0 +1,108 @@
+#include <isa.h>
+#include <mtrace-def.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef CONFIG_MTRACE
+
+/* The records are written into one of the buffers. A full buffer is
+ * queued to the writer thread, and the next free one is used, so that
+ * the guest only waits for the disk when all the buffers are queued.
+ * The buffers [head, tail) are queued, and the tail one is being filled.
+ */
+
+#define NR_BUF 4
+
+static MTraceEntry buf[NR_BUF][CONFIG_MTRACE_BUF_SIZE];
+static int buf_cnt[NR_BUF];
+static MTraceEntry *pos = buf[0], *buf_end = buf[0] + CONFIG_MTRACE_BUF_SIZE;
+static uint64_t head = 0, tail = 0;
+static bool is_quit = false;
+static int fd = -1;
+static pthread_t writer;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+
+static void* writer_thread(void *arg) {
+  pthread_mutex_lock(&lock);
+  while (true) {
+    while (head == tail && !is_quit) pthread_cond_wait(&cond, &lock);
+    if (head == tail) break;
+    int idx = head % NR_BUF;
+    pthread_mutex_unlock(&lock);
+
+    size_t size = buf_cnt[idx] * sizeof(MTraceEntry);
+    // do not assert here, since assert_fail_msg() waits for this thread
+    if (write(fd, buf[idx], size) != size) perror("Fail to write the memory trace");
+
+    pthread_mutex_lock(&lock);
+    head ++;
+    pthread_cond_broadcast(&cond);
+  }
+  pthread_mutex_unlock(&lock);
+  return NULL;
+}
+
+// queue the buffer being filled, and wait for the next free one
+static void submit() {
+  pthread_mutex_lock(&lock);
+  buf_cnt[tail % NR_BUF] = pos - buf[tail % NR_BUF];
+  tail ++;
+  pthread_cond_broadcast(&cond);
+  while (tail - head == NR_BUF) pthread_cond_wait(&cond, &lock);
+  pthread_mutex_unlock(&lock);
+  pos = buf[tail % NR_BUF];
+  buf_end = pos + CONFIG_MTRACE_BUF_SIZE;
+}
+
+void mtrace_record(paddr_t addr, int len, int type, word_t data) {
+  if (unlikely(pos == buf_end)) submit();
+  *pos ++ = (MTraceEntry) { .pc = cpu.pc, .addr = addr, .data = data,
+    .len = len, .type = type };
+}
+
+// wait until all the records are written
+void mtrace_flush() {
+  if (fd < 0) return;
+  if (pos != buf[tail % NR_BUF]) submit();
+  pthread_mutex_lock(&lock);
+  while (head != tail) pthread_cond_wait(&cond, &lock);
+  pthread_mutex_unlock(&lock);
+}
+
+static void mtrace_close() {
+  mtrace_flush();
+  pthread_mutex_lock(&lock);
+  is_quit = true;
+  pthread_cond_broadcast(&cond);
+  pthread_mutex_unlock(&lock);
+  pthread_join(writer, NULL);
+  close(fd);
+  fd = -1;
+}
+
+// Only the calling thread survives fork() (see checkpoint.c), so the
+// records are flushed before, and the writer is restarted in the child.
+static void prepare_fork() { mtrace_flush(); }
+
+static void restart_writer() {
+  pthread_mutex_init(&lock, NULL);
+  pthread_cond_init(&cond, NULL);
+  if (fd >= 0) pthread_create(&writer, NULL, writer_thread, NULL);
+}
+
+void init_mtrace(const char *file) {
+  fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  Assert(fd >= 0, "Can not open '%s'", file);
+  MTraceHeader h = { .magic = MTRACE_MAGIC, .version = MTRACE_VERSION,
+    .isa = str(__GUEST_ISA__) };
+  ssize_t ret = write(fd, &h, sizeof(h));
+  assert(ret == sizeof(h));
+
+  pthread_create(&writer, NULL, writer_thread, NULL);
+  pthread_atfork(prepare_fork, NULL, restart_writer);
+  atexit(mtrace_close);
+  Log("Memory trace is written to %s", file);
+}
+#endif
@@ -0,0 +1,54 @@
+#include <common.h>
+
+/* Counting by PC for the profiler and the statistics of the basic blocks,
+ * in a hash table with linear probing.
+ */
+
+#define INIT_BITS 12
+
+static PCCount* find(PCCount *t, int bits, vaddr_t pc) {
+  uint32_t mask = (1u << bits) - 1;
+  uint32_t i = ((uint64_t)pc * 0x9e3779b97f4a7c15ull) >> (64 - bits);
+  while (t[i].cnt != 0 && t[i].pc != pc) i = (i + 1) & mask;
+  return &t[i];
+}
+
+static void grow(PCCounter *c) {
+  int bits = (c->tab == NULL ? INIT_BITS : c->bits + 1);
+  PCCount *t = calloc(1ul << bits, sizeof(PCCount));
+  assert(t);
+  uint32_t i;
+  for (i = 0; c->tab != NULL && i < (1u << c->bits); i ++) {
+    if (c->tab[i].cnt != 0) *find(t, bits, c->tab[i].pc) = c->tab[i];
+  }
+  free(c->tab);
+  c->tab = t;
+  c->bits = bits;
+}
+
+void pc_count(PCCounter *c, vaddr_t pc) {
+  // keep the load factor under 1/2
+  if (c->tab == NULL || c->nr * 2 >= (1 << c->bits)) grow(c);
+  PCCount *p = find(c->tab, c->bits, pc);
+  if (p->cnt == 0) {
+    p->pc = pc;
+    c->nr ++;
+  }
+  p->cnt ++;
+}
+
+static int cmp_count(const void *a, const void *b) {
+  const PCCount *x = a, *y = b;
+  return (x->cnt < y->cnt) - (x->cnt > y->cnt);
+}
+
+PCCount* pc_count_sorted(const PCCounter *c) {
+  PCCount *p = malloc(sizeof(PCCount) * (c->nr + 1));
+  assert(p);
+  int i, n = 0;
+  for (i = 0; c->tab != NULL && i < (1 << c->bits); i ++) {
+    if (c->tab[i].cnt != 0) p[n ++] = c->tab[i];
+  }
+  qsort(p, n, sizeof(PCCount), cmp_count);
+  return p;
+}
@@ -0,0 +1,91 @@
+#include <isa.h>
+
+#ifdef CONFIG_PROFILE
+
+/* A sampling profiler. A sample is taken when the number of guest
+ * instructions reaches `g_profile_instr`, which is moved forward by
+ * PROFILE_INTERVAL after each sample, or when `g_profile_alarm` is set by
+ * the alarm. The samples are counted by PC.
+ */
+
+#define TOP_PC 10
+#define TOP_FUNC 10
+
+#ifdef CONFIG_PROFILE_BY_TIMER
+#include <signal.h>
+#include <device/alarm.h>
+// the only type that the signal handler can write safely
+volatile sig_atomic_t g_profile_alarm = 0;
+#else
+uint64_t g_profile_instr = UINT64_MAX;
+#endif
+extern uint64_t g_nr_guest_instr;
+
+static PCCounter sample = {};
+static uint64_t nr_sample = 0;
+
+void profile_sample(vaddr_t pc) {
+  MUXDEF(CONFIG_PROFILE_BY_TIMER, g_profile_alarm = 0,
+      g_profile_instr = g_nr_guest_instr + CONFIG_PROFILE_INTERVAL);
+  pc_count(&sample, pc);
+  nr_sample ++;
+}
+
+#ifdef CONFIG_PROFILE_BY_TIMER
+// only ask for a sample here, and it is taken before the next instruction
+static void profile_alarm() { g_profile_alarm = 1; }
+#else
+// called by cpu_exec(), since the number of instructions may go back by
+// loading a snapshot, and the next sample would be too far away
+void profile_update() {
+  if (g_profile_instr > g_nr_guest_instr + CONFIG_PROFILE_INTERVAL) {
+    g_profile_instr = g_nr_guest_instr + CONFIG_PROFILE_INTERVAL;
+  }
+}
+#endif
+
+void init_profile() {
+  IFDEF(CONFIG_PROFILE_BY_INSTR, g_profile_instr = g_nr_guest_instr + CONFIG_PROFILE_INTERVAL);
+  IFDEF(CONFIG_PROFILE_BY_TIMER, add_alarm_handle(profile_alarm));
+}
+
+void profile_report() {
+  if (nr_sample == 0) {
+    Log("No samples are taken by the profiler");
+    return;
+  }
+
+  PCCount *s = pc_count_sorted(&sample);
+  int i, n = sample.nr;
+  Log("Profiler: %lu samples at %d PCs, top PCs:", nr_sample, n);
+  for (i = 0; i < n && i < TOP_PC; i ++) {
+    char where[128];
+    symbol_where(s[i].pc, where, sizeof(where));
+    Log("%7.2f%% %10lu  " FMT_WORD "  %s", s[i].cnt * 100.0 / nr_sample, s[i].cnt, s[i].pc, where);
+  }
+
+  if (symbol_nr() > 0) {
+    // the samples outside any function are counted in the last slot
+    uint64_t *func = calloc(symbol_nr() + 1, sizeof(uint64_t));
+    assert(func);
+    for (i = 0; i < n; i ++) {
+      int f = symbol_find(s[i].pc);
+      func[f >= 0 ? f : symbol_nr()] += s[i].cnt;
+    }
+    Log("Top functions:");
+    int k;
+    for (k = 0; k < TOP_FUNC; k ++) {
+      int max = -1;
+      for (i = 0; i <= symbol_nr(); i ++) {
+        if (func[i] > 0 && (max < 0 || func[i] > func[max])) max = i;
+      }
+      if (max < 0) break;
+      const Symbol *sym = symbol_get(max);
+      Log("%7.2f%% %10lu  %s", func[max] * 100.0 / nr_sample, func[max], sym ? sym->name : "[unknown]");
+      func[max] = 0;
+    }
+    free(func);
+  }
+  free(s);
+}
+#endif
@@ -0,0 +1,100 @@
+#include <common.h>
+#include <elf.h>
+
+/* The function symbols of the guest, loaded from the ELF file given by
+ * --elf. They are sorted by the start address, so that the function
+ * containing an address can be found by binary search.
+ */
+
+#define Elf(type) concat(MUXDEF(CONFIG_ISA64, Elf64_, Elf32_), type)
+#define ELF_CLASS MUXDEF(CONFIG_ISA64, ELFCLASS64, ELFCLASS32)
+#define ELF_ST_TYPE MUXDEF(CONFIG_ISA64, ELF64_ST_TYPE, ELF32_ST_TYPE)
+
+static Symbol *sym = NULL;
+static int nr_sym = 0;
+
+static int cmp_symbol(const void *a, const void *b) {
+  const Symbol *x = a, *y = b;
+  return (x->start > y->start) - (x->start < y->start);
+}
+
+void init_symbol(const char *elf_file) {
+  FILE *fp = fopen(elf_file, "rb");
+  Assert(fp, "Can not open '%s'", elf_file);
+  fseek(fp, 0, SEEK_END);
+  long size = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  uint8_t *buf = malloc(size);
+  assert(buf);
+  int ret = fread(buf, size, 1, fp);
+  assert(ret == 1);
+  fclose(fp);
+
+  Elf(Ehdr) *eh = (void *)buf;
+  Assert(size >= sizeof(*eh) && memcmp(eh->e_ident, ELFMAG, SELFMAG) == 0 &&
+      eh->e_ident[EI_CLASS] == ELF_CLASS, "'%s' is not an ELF file of %s", elf_file, str(__GUEST_ISA__));
+  Assert(eh->e_shoff + (long)eh->e_shnum * sizeof(Elf(Shdr)) <= size, "'%s' is corrupted", elf_file);
+  Elf(Shdr) *sh = (void *)(buf + eh->e_shoff);
+
+  int i, j;
+  for (i = 0; i < eh->e_shnum; i ++) {
+    if (sh[i].sh_type != SHT_SYMTAB || sh[i].sh_link >= eh->e_shnum) continue;
+    Elf(Shdr) *strtab = &sh[sh[i].sh_link];
+    Assert(sh[i].sh_offset + sh[i].sh_size <= size &&
+        strtab->sh_offset + strtab->sh_size <= size, "'%s' is corrupted", elf_file);
+    Elf(Sym) *st = (void *)(buf + sh[i].sh_offset);
+    int n = sh[i].sh_size / sizeof(Elf(Sym));
+    sym = realloc(sym, sizeof(Symbol) * (nr_sym + n));
+    assert(sym);
+    for (j = 0; j < n; j ++) {
+      if (ELF_ST_TYPE(st[j].st_info) != STT_FUNC || st[j].st_name >= strtab->sh_size) continue;
+      const char *name = (char *)buf + strtab->sh_offset + st[j].st_name;
+      sym[nr_sym ++] = (Symbol) { .start = st[j].st_value,
+        .end = st[j].st_value + st[j].st_size, .name = strdup(name) };
+    }
+  }
+  free(buf);
+
+  qsort(sym, nr_sym, sizeof(Symbol), cmp_symbol);
+  // drop the aliases, and extend the functions without a size to the next one
+  for (i = 0, j = 0; i < nr_sym; i ++) {
+    if (j > 0 && sym[j - 1].start == sym[i].start) continue;
+    sym[j ++] = sym[i];
+  }
+  nr_sym = j;
+  for (i = 0; i < nr_sym; i ++) {
+    if (sym[i].end == sym[i].start && i + 1 < nr_sym) sym[i].end = sym[i + 1].start;
+  }
+  Log("Load %d function symbols from %s", nr_sym, elf_file);
+}
+
+int symbol_find(vaddr_t addr) {
+  int l = 0, r = nr_sym - 1;
+  // find the last function starting at or before `addr`
+  while (l <= r) {
+    int m = (l + r) / 2;
+    if (sym[m].start <= addr) l = m + 1;
+    else r = m - 1;
+  }
+  return (r >= 0 && addr < sym[r].end ? r : -1);
+}
+
+int symbol_lookup(const char *name) {
+  int i;
+  for (i = 0; i < nr_sym; i ++) {
+    if (strcmp(sym[i].name, name) == 0) return i;
+  }
+  return -1;
+}
+
+const Symbol* symbol_get(int idx) {
+  return (idx >= 0 && idx < nr_sym ? &sym[idx] : NULL);
+}
+
+int symbol_nr() { return nr_sym; }
+
+void symbol_where(vaddr_t addr, char *buf, int len) {
+  const Symbol *s = symbol_get(symbol_find(addr));
+  if (s) snprintf(buf, len, "%s+0x%lx", s->name, (uint64_t)(addr - s->start));
+  else if (len > 0) buf[0] = '\0';
+}
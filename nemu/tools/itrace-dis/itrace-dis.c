@@ -0,0 +1,108 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <itrace-def.h>
+
+/* Disassemble the instruction trace dumped by NEMU with CONFIG_ITRACE_RING.
+ * Usage: itrace-dis FILE [N]
+ * Only the last N instructions are printed if N is given.
+ */
+
+void init_disasm(const char *triple);
+void disassemble(char *str, int size, uint64_t pc, uint8_t *code, int nbyte);
+
+static uint8_t *buf = NULL;
+static long buf_size = 0;
+
+static const char *isa2triple(const char *isa) {
+  if (strcmp(isa, "x86") == 0) return "i686-pc-linux-gnu";
+  if (strcmp(isa, "mips32") == 0) return "mipsel-pc-linux-gnu";
+  if (strcmp(isa, "riscv32") == 0) return "riscv32-pc-linux-gnu";
+  if (strcmp(isa, "riscv64") == 0) return "riscv64-pc-linux-gnu";
+  return NULL;
+}
+
+static void load_file(const char *file) {
+  FILE *fp = fopen(file, "rb");
+  if (fp == NULL) {
+    printf("Can not open '%s'\n", file);
+    exit(1);
+  }
+  fseek(fp, 0, SEEK_END);
+  buf_size = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  buf = malloc(buf_size);
+  assert(buf);
+  int ret = fread(buf, buf_size, 1, fp);
+  assert(ret == 1 || buf_size == 0);
+  fclose(fp);
+}
+
+// decode all the blocks, and print the instructions from the `skip`-th one,
+// return the number of instructions
+static uint64_t walk(const ITraceHeader *h, uint64_t skip, int pc_width) {
+  static ITraceCache cache[1 << ITRACE_CACHE_BITS];
+  const uint8_t *p = buf + sizeof(*h);
+  uint64_t n = 0;
+  uint32_t i;
+  for (i = 0; i < h->nr_block; i ++) {
+    ITraceBlock b;
+    assert(p + sizeof(b) <= buf + buf_size);
+    memcpy(&b, p, sizeof(b));
+    p += sizeof(b);
+    const uint8_t *end = p + b.size;
+    assert(end <= buf + buf_size);
+
+    memset(cache, 0, sizeof(cache));
+    uint64_t next_pc = 0, idx = b.first;
+    while (p < end) {
+      uint64_t pc;
+      uint8_t instr[ITRACE_MAX_ILEN];
+      int ilen;
+      p = itrace_decode(p, &next_pc, cache, &pc, instr, &ilen);
+      if (n ++ < skip) { idx ++; continue; }
+
+      char line[256], *q = line;
+      q += sprintf(q, "[%lu] 0x%0*lx:", idx ++, pc_width, pc);
+      int j;
+      for (j = 0; j < ilen; j ++) q += sprintf(q, " %02x", instr[j]);
+      for (; j < 4; j ++) q += sprintf(q, "   ");
+      *q ++ = ' ';
+      disassemble(q, line + sizeof(line) - q, pc, instr, ilen);
+      puts(line);
+    }
+  }
+  return n;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    printf("Usage: %s FILE [N]\n", argv[0]);
+    return 1;
+  }
+  load_file(argv[1]);
+
+  ITraceHeader h;
+  if (buf_size < sizeof(h) || (memcpy(&h, buf, sizeof(h)), h.magic != ITRACE_MAGIC) ||
+      h.version != ITRACE_VERSION) {
+    printf("'%s' is not an instruction trace of NEMU\n", argv[1]);
+    return 1;
+  }
+  const char *triple = isa2triple(h.isa);
+  if (triple == NULL) {
+    printf("Unsupported ISA '%s'\n", h.isa);
+    return 1;
+  }
+  init_disasm(triple);
+
+  int pc_width = (strstr(h.isa, "64") ? 16 : 8);
+  uint64_t skip = 0;
+  if (argc > 2) {
+    uint64_t total = walk(&h, UINT64_MAX, pc_width);
+    uint64_t last = strtoull(argv[2], NULL, 0);
+    skip = (total > last ? total - last : 0);
+  }
+  walk(&h, skip, pc_width);
+  return 0;
+}
@@ -335,6 +335,13 @@ void difftest_memcpy(paddr_t addr, void *buf, size_t n, bool direction) {
   else memcpy(buf, vm.mem + addr, n);
 }
 
+void difftest_memhash(paddr_t *addr, uint64_t *hash, int n) {
+  int i;
+  for (i = 0; i < n; i ++) {
+    hash[i] = difftest_page_hash(vm.mem + addr[i], DIFFTEST_PAGE_SIZE);
+  }
+}
+
 void difftest_regcpy(void *r, bool direction) {
   struct kvm_regs *ref = &(vcpu.kvm_run->s.regs.regs);
   x86_CPU_state *x86 = r;
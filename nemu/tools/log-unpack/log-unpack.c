@@ -0,0 +1,48 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <log-def.h>
+
+/* Decompress the log written by NEMU with CONFIG_LOG_COMPRESS to stdout.
+ * Usage: log-unpack FILE...
+ * The rotated files should be given from the oldest one, for example
+ *   log-unpack build/nemu-log.txt.2 build/nemu-log.txt.1 build/nemu-log.txt
+ */
+
+int lz_decompress(const void *in, int in_len, void *out, int out_len);
+
+static int unpack(const char *file) {
+  FILE *fp = fopen(file, "rb");
+  if (fp == NULL) {
+    fprintf(stderr, "Can not open '%s'\n", file);
+    return 1;
+  }
+  static uint8_t in[LOG_FRAME_MAX], out[LOG_FRAME_MAX];
+  LogFrame f;
+  int ret = 0;
+  while (fread(&f, sizeof(f), 1, fp) == 1) {
+    if (f.raw_size > LOG_FRAME_MAX || f.size > f.raw_size ||
+        fread(in, f.size, 1, fp) != 1) {
+      ret = 1;
+      break;
+    }
+    if (f.size == f.raw_size) fwrite(in, f.size, 1, stdout);
+    else if (lz_decompress(in, f.size, out, f.raw_size) == f.raw_size) fwrite(out, f.raw_size, 1, stdout);
+    else {
+      ret = 1;
+      break;
+    }
+  }
+  if (ret != 0) fprintf(stderr, "'%s' is corrupted\n", file);
+  fclose(fp);
+  return ret;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    printf("Usage: %s FILE...\n", argv[0]);
+    return 1;
+  }
+  int i, ret = 0;
+  for (i = 1; i < argc; i ++) ret |= unpack(argv[i]);
+  return ret;
+}
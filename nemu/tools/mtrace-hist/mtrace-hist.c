@@ -0,0 +1,215 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <getopt.h>
+#include <mtrace-def.h>
+
+/* Build the histograms of the memory trace written by NEMU with
+ * CONFIG_MTRACE, for cache modeling.
+ * Usage: mtrace-hist [-t TYPES] [-l LINE] [-w WINDOW] FILE
+ *   -t  the types of accesses to count, any of "rwx", default "rw"
+ *   -l  the size of a cache line in bytes, default 64
+ *   -w  the number of accesses in a window of the working set, default 100000
+ * The working set of a window is the number of distinct lines accessed
+ * in it. The stride of an access is the distance from the address of the
+ * last access by the same instruction (the same PC) with the same type.
+ */
+
+#define NR_BUCKET 64
+#define STRIDE_BITS 16
+#define PC_BITS 16
+#define TOP_STRIDES 16
+
+typedef struct {
+  uint64_t key;
+  uint64_t val;
+  bool valid;
+} Slot;
+
+// open addressing with linear probing, return NULL if the table is full
+static Slot* lookup(Slot *tab, int bits, uint64_t key) {
+  uint32_t mask = (1u << bits) - 1;
+  uint32_t i = (uint32_t)((key * 0x9e3779b97f4a7c15ull) >> (64 - bits));
+  uint32_t n;
+  for (n = 0; n <= mask; n ++, i = (i + 1) & mask) {
+    if (!tab[i].valid || tab[i].key == key) return &tab[i];
+  }
+  return NULL;
+}
+
+static int line_shift = 6;
+static uint64_t window = 100000;
+static int types = MTRACE_READ | MTRACE_WRITE;
+
+static uint64_t nr_type[8] = {};
+
+// the working set
+static uint64_t *line_gen = NULL; // the window in which a slot is used
+static uint64_t *line_key = NULL;
+static int line_bits = 0;
+static uint64_t gen = 1, nr_in_window = 0, nr_line = 0;
+static uint64_t ws_hist[NR_BUCKET] = {};
+static uint64_t ws_min = UINT64_MAX, ws_max = 0, ws_sum = 0, nr_window = 0;
+
+// the strides
+static Slot last_addr[1 << PC_BITS];
+static Slot stride_cnt[1 << STRIDE_BITS];
+static uint64_t nr_stride = 0, nr_first = 0, nr_stride_drop = 0;
+
+static int log2_bucket(uint64_t v) {
+  int b = 0;
+  while (v > 1) { v >>= 1; b ++; }
+  return b;
+}
+
+static void end_window() {
+  if (nr_in_window == 0) return;
+  ws_hist[log2_bucket(nr_line)] ++;
+  if (nr_line < ws_min) ws_min = nr_line;
+  if (nr_line > ws_max) ws_max = nr_line;
+  ws_sum += nr_line;
+  nr_window ++;
+  gen ++;
+  nr_in_window = 0;
+  nr_line = 0;
+}
+
+static void count_line(uint64_t line) {
+  uint32_t mask = (1u << line_bits) - 1;
+  uint32_t i = (uint32_t)((line * 0x9e3779b97f4a7c15ull) >> (64 - line_bits));
+  // the table is twice as large as a window, so it never becomes full
+  while (line_gen[i] == gen && line_key[i] != line) i = (i + 1) & mask;
+  if (line_gen[i] != gen) {
+    line_gen[i] = gen;
+    line_key[i] = line;
+    nr_line ++;
+  }
+  if (++ nr_in_window == window) end_window();
+}
+
+static void count_stride(const MTraceEntry *e) {
+  // the PC and the type share the key
+  Slot *s = lookup(last_addr, PC_BITS, (e->pc << 3) | e->type);
+  if (s == NULL) { nr_stride_drop ++; return; }
+  if (!s->valid) {
+    s->valid = true;
+    s->key = (e->pc << 3) | e->type;
+    s->val = e->addr;
+    nr_first ++;
+    return;
+  }
+  uint64_t stride = e->addr - s->val;
+  s->val = e->addr;
+  Slot *c = lookup(stride_cnt, STRIDE_BITS, stride);
+  if (c == NULL) { nr_stride_drop ++; return; }
+  c->valid = true;
+  c->key = stride;
+  c->val ++;
+  nr_stride ++;
+}
+
+static int cmp_slot(const void *a, const void *b) {
+  const Slot *x = a, *y = b;
+  if (x->valid != y->valid) return y->valid - x->valid;
+  return (x->val < y->val) - (x->val > y->val);
+}
+
+static void report() {
+  end_window();
+  printf("accesses: %lu loads, %lu stores, %lu fetches\n",
+      nr_type[MTRACE_READ], nr_type[MTRACE_WRITE], nr_type[MTRACE_FETCH]);
+
+  printf("\nworking set (%d-byte lines in windows of %lu accesses)\n", 1 << line_shift, window);
+  if (nr_window == 0) printf("  no accesses\n");
+  else {
+    printf("  windows = %lu, min = %lu, avg = %lu, max = %lu lines\n",
+        nr_window, ws_min, ws_sum / nr_window, ws_max);
+    int i;
+    for (i = 0; i < NR_BUCKET; i ++) {
+      if (ws_hist[i] == 0) continue;
+      printf("  [%10lu, %10lu) lines  %8lu  %6.2f%%\n", 1ul << i, 2ul << i,
+          ws_hist[i], ws_hist[i] * 100.0 / nr_window);
+    }
+  }
+
+  printf("\nstride (by PC)\n");
+  printf("  strides = %lu, first accesses = %lu, dropped = %lu\n",
+      nr_stride, nr_first, nr_stride_drop);
+  qsort(stride_cnt, 1 << STRIDE_BITS, sizeof(Slot), cmp_slot);
+  uint64_t shown = 0;
+  int i;
+  for (i = 0; i < TOP_STRIDES && stride_cnt[i].valid; i ++) {
+    printf("  %+12ld  %10lu  %6.2f%%\n", (int64_t)stride_cnt[i].key,
+        stride_cnt[i].val, stride_cnt[i].val * 100.0 / nr_stride);
+    shown += stride_cnt[i].val;
+  }
+  if (shown < nr_stride) {
+    printf("  %12s  %10lu  %6.2f%%\n", "others",
+        nr_stride - shown, (nr_stride - shown) * 100.0 / nr_stride);
+  }
+}
+
+static int parse_types(const char *s) {
+  int t = 0;
+  for (; *s; s ++) {
+    switch (*s) {
+      case 'r': t |= MTRACE_READ; break;
+      case 'w': t |= MTRACE_WRITE; break;
+      case 'x': t |= MTRACE_FETCH; break;
+      default: return 0;
+    }
+  }
+  return t;
+}
+
+int main(int argc, char *argv[]) {
+  int o;
+  while ((o = getopt(argc, argv, "t:l:w:")) != -1) {
+    switch (o) {
+      case 't': types = parse_types(optarg); break;
+      case 'l': line_shift = log2_bucket(strtoul(optarg, NULL, 0)); break;
+      case 'w': window = strtoull(optarg, NULL, 0); break;
+      default: types = 0; break;
+    }
+  }
+  if (optind >= argc || types == 0 || window == 0) {
+    printf("Usage: %s [-t TYPES] [-l LINE] [-w WINDOW] FILE\n", argv[0]);
+    return 1;
+  }
+
+  const char *file = argv[optind];
+  FILE *fp = fopen(file, "rb");
+  if (fp == NULL) {
+    printf("Can not open '%s'\n", file);
+    return 1;
+  }
+  MTraceHeader h;
+  if (fread(&h, sizeof(h), 1, fp) != 1 || h.magic != MTRACE_MAGIC || h.version != MTRACE_VERSION) {
+    printf("'%s' is not a memory trace of NEMU\n", file);
+    return 1;
+  }
+
+  while ((1ull << line_bits) < window * 2) line_bits ++;
+  line_gen = calloc(1ull << line_bits, sizeof(line_gen[0]));
+  line_key = calloc(1ull << line_bits, sizeof(line_key[0]));
+  assert(line_gen && line_key);
+
+  static MTraceEntry buf[4096];
+  size_t n;
+  while ((n = fread(buf, sizeof(buf[0]), 4096, fp)) > 0) {
+    size_t i;
+    for (i = 0; i < n; i ++) {
+      MTraceEntry *e = &buf[i];
+      if (!(e->type & types)) continue;
+      nr_type[e->type] ++;
+      count_line(e->addr >> line_shift);
+      count_stride(e);
+    }
+  }
+  fclose(fp);
+
+  report();
+  return 0;
+}
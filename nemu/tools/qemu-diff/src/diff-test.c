@@ -1,9 +1,11 @@
 #include "common.h"
 #include <difftest-def.h>
 #include <sys/prctl.h>
+#include <sys/mman.h>
 #include <signal.h>
+#include <fcntl.h>
 
-bool gdb_connect_qemu(int);
+bool gdb_connect_qemu(const char *);
 bool gdb_memcpy_to_qemu(uint32_t, void *, int);
 bool gdb_getregs(union isa_gdb_regs *);
 bool gdb_setregs(union isa_gdb_regs *);
@@ -12,11 +14,34 @@ void gdb_exit();
 
 void init_isa();
 
+// the guest memory of QEMU, which is backed by a file shared with us
+static uint8_t *pmem = NULL;
+static bool is_qemu_started = false;
+
+static uint8_t *guest_to_qemu(paddr_t addr, size_t n) {
+  assert(addr >= CONFIG_MBASE && addr - CONFIG_MBASE + n <= CONFIG_MSIZE);
+  return pmem + (addr - CONFIG_MBASE);
+}
+
 void difftest_memcpy(paddr_t addr, void *buf, size_t n, bool direction) {
-  assert(direction == DIFFTEST_TO_REF);
   if (direction == DIFFTEST_TO_REF) {
-    bool ok = gdb_memcpy_to_qemu(addr, buf, n);
-    assert(ok == 1);
+    // QEMU does not notice the code modified through the shared memory
+    // and keeps running the stale translated blocks. Therefore after QEMU
+    // starts, write the memory with gdb to let QEMU flush its code cache.
+    if (!is_qemu_started) memcpy(guest_to_qemu(addr, n), buf, n);
+    else {
+      bool ok = gdb_memcpy_to_qemu(addr, buf, n);
+      assert(ok == 1);
+    }
+  } else {
+    memcpy(buf, guest_to_qemu(addr, n), n);
+  }
+}
+
+void difftest_memhash(paddr_t *addr, uint64_t *hash, int n) {
+  int i;
+  for (i = 0; i < n; i ++) {
+    hash[i] = difftest_page_hash(guest_to_qemu(addr[i], DIFFTEST_PAGE_SIZE), DIFFTEST_PAGE_SIZE);
   }
 }
 
@@ -32,12 +57,36 @@ void difftest_regcpy(void *dut, bool direction) {
 }
 
 void difftest_exec(uint64_t n) {
+  is_qemu_started = true;
   while (n --) gdb_si();
 }
 
+static void init_pmem(const char *path) {
+  int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+  if (fd == -1) {
+    perror("open");
+    assert(0);
+  }
+  int ret = ftruncate(fd, CONFIG_MSIZE);
+  assert(ret == 0);
+  pmem = mmap(NULL, CONFIG_MSIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  assert(pmem != MAP_FAILED);
+  close(fd);
+}
+
 void difftest_init(int port) {
-  char buf[32];
-  sprintf(buf, "tcp::%d", port);
+  // make the paths unique with the pid of NEMU and the port given by
+  // --port, so that several REFs can be started by the same process
+  char sock_path[64], mem_path[64];
+  sprintf(sock_path, "/tmp/nemu-qemu-%d-%d.sock", getpid(), port);
+  sprintf(mem_path, "/dev/shm/nemu-qemu-%d-%d.mem", getpid(), port);
+  unlink(sock_path);
+  init_pmem(mem_path);
+
+  char chardev[128], memdev[256], msize[32];
+  sprintf(chardev, "socket,id=gdb0,path=%s,server=on,wait=off", sock_path);
+  sprintf(msize, "%dM", CONFIG_MSIZE / (1024 * 1024));
+  sprintf(memdev, "memory-backend-file,id=pmem,size=%s,mem-path=%s,share=on", msize, mem_path);
 
   int ppid_before_fork = getpid();
   int pid = fork();
@@ -61,16 +110,23 @@ void difftest_init(int port) {
     }
 
     close(STDIN_FILENO);
-    execlp(ISA_QEMU_BIN, ISA_QEMU_BIN, ISA_QEMU_ARGS "-S", "-gdb", buf, "-nographic",
-        "-serial", "none", "-monitor", "none", NULL);
+    execlp(ISA_QEMU_BIN, ISA_QEMU_BIN, ISA_QEMU_ARGS "-S",
+        "-chardev", chardev, "-gdb", "chardev:gdb0",
+        "-object", memdev, "-machine", "memory-backend=pmem", "-m", msize,
+        "-nographic", "-serial", "none", "-monitor", "none", NULL);
     perror("exec");
     assert(0);
   }
   else {
     // father
 
-    gdb_connect_qemu(port);
-    printf("Connect to QEMU with %s successfully\n", buf);
+    bool ok = gdb_connect_qemu(sock_path);
+    assert(ok);
+    printf("Connect to QEMU with %s successfully\n", sock_path);
+
+    // QEMU has opened them, now they can be removed
+    unlink(sock_path);
+    unlink(mem_path);
 
     atexit(gdb_exit);
 
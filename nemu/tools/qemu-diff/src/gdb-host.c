@@ -2,13 +2,19 @@
 
 static struct gdb_conn *conn;
 
-bool gdb_connect_qemu(int port) {
-  // connect to gdbserver on localhost port 1234
-  while ((conn = gdb_begin_inet("127.0.0.1", port)) == NULL) {
+// The registers of QEMU only change after stepping, so keep
+// the last copy to save the round trips of the `g` packets.
+static union isa_gdb_regs regs_cache;
+static bool is_regs_cached = false;
+
+bool gdb_connect_qemu(const char *path) {
+  // connect to gdbserver listening on the UNIX socket
+  while ((conn = gdb_begin_unix(path)) == NULL) {
     usleep(1);
   }
 
-  return true;
+  // no more '+' for every packet
+  return !strcmp(gdb_start_noack(conn), "OK");
 }
 
 static bool gdb_memcpy_to_qemu_small(uint32_t dest, void *src, int len) {
@@ -45,6 +51,11 @@ bool gdb_memcpy_to_qemu(uint32_t dest, void *src, int len) {
 }
 
 bool gdb_getregs(union isa_gdb_regs *r) {
+  if (is_regs_cached) {
+    *r = regs_cache;
+    return true;
+  }
+
   gdb_send(conn, (const uint8_t *)"g", 1);
   size_t size;
   uint8_t *reply = gdb_recv(conn, &size);
@@ -62,6 +73,8 @@ bool gdb_getregs(union isa_gdb_regs *r) {
 
   free(reply);
 
+  regs_cache = *r;
+  is_regs_cached = true;
   return true;
 }
 
@@ -86,10 +99,13 @@ bool gdb_setregs(union isa_gdb_regs *r) {
   bool ok = !strcmp((const char*)reply, "OK");
   free(reply);
 
+  regs_cache = *r;
+  is_regs_cached = ok;
   return ok;
 }
 
 bool gdb_si() {
+  is_regs_cached = false;
   char buf[] = "vCont;s:1";
   gdb_send(conn, (const uint8_t *)buf, strlen(buf));
   size_t size;
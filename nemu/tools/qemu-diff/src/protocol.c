@@ -28,6 +28,7 @@
 
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/un.h>
 
 struct gdb_conn {
   FILE *in;
@@ -128,6 +129,26 @@ struct gdb_conn* gdb_begin_inet(const char *addr, uint16_t port) {
   return gdb_begin(fd);
 }
 
+struct gdb_conn* gdb_begin_unix(const char *path) {
+  // fill the socket information
+  struct sockaddr_un sa = { .sun_family = AF_UNIX };
+  if (strlen(path) >= sizeof(sa.sun_path))
+    errx(1, "Socket path too long: %s", path);
+  strcpy(sa.sun_path, path);
+
+  // open the socket and connect to the server
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    err(1, "socket");
+  if (connect(fd, (const struct sockaddr *)&sa, sizeof(sa)) != 0) {
+    close(fd);
+    return NULL;
+  }
+
+  // initialize the rest of gdb on this handle
+  return gdb_begin(fd);
+}
+
 
 void gdb_end(struct gdb_conn *conn) {
   fclose(conn->in);
@@ -64,13 +64,28 @@ void sim_t::diff_memcpy(reg_t dest, void* src, size_t n) {
   }
 }
 
+static void diff_memcpy_to_dut(reg_t src, void* dest, size_t n) {
+  mmu_t* mmu = p->get_mmu();
+  for (size_t i = 0; i < n; i++) {
+    *((uint8_t*)dest+i) = mmu->load_uint8(src+i);
+  }
+}
+
 extern "C" {
 
 void difftest_memcpy(paddr_t addr, void *buf, size_t n, bool direction) {
   if (direction == DIFFTEST_TO_REF) {
     s->diff_memcpy(addr, buf, n);
   } else {
-    assert(0);
+    diff_memcpy_to_dut(addr, buf, n);
+  }
+}
+
+void difftest_memhash(paddr_t *addr, uint64_t *hash, int n) {
+  uint8_t buf[DIFFTEST_PAGE_SIZE];
+  for (int i = 0; i < n; i++) {
+    diff_memcpy_to_dut(addr[i], buf, DIFFTEST_PAGE_SIZE);
+    hash[i] = difftest_page_hash(buf, DIFFTEST_PAGE_SIZE);
   }
 }
 